@@ -1,6 +1,13 @@
 ﻿#include "bitecs/bitecs.hpp"
 #include "components.hpp"
+#include "memory_usage.hpp"
+#include "perf_counters.hpp"
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 struct ECS_Interface
 {
@@ -17,6 +24,7 @@ struct ECS_Interface
     void RemoveComponentFrom(Entity entt);
     template<typename Component>
     Component& GetComponent(Entity entt);
+    void DestroyEntt(Entity entt);
 };
 
 
@@ -113,6 +121,7 @@ static void BM_Systems(benchmark::State& state)
     ECS ecs;
     CreateEntities(state, ecs);
     auto protagonist = CreateProtag(ecs);
+    PerfCounters perf(state);
     for ([[maybe_unused]] auto _: state) {
         RunSystems(ecs);
         PlotArmor(ecs, protagonist);
@@ -122,6 +131,7 @@ static void BM_Systems(benchmark::State& state)
 template<typename ECS>
 static void BM_Create_Destroy(benchmark::State& state)
 {
+    PerfCounters perf(state);
     for ([[maybe_unused]] auto _: state) {
         ECS ecs;
         CreateEntities(state, ecs);
@@ -134,6 +144,7 @@ static void BM_Add_Get_Remove(benchmark::State& state)
     ECS ecs;
     auto protagonist = CreateProtag(ecs);
     ecs.template RemoveComponentFrom<PositionComponent>(protagonist);
+    PerfCounters perf(state);
     for ([[maybe_unused]] auto _: state) {
         ecs.template AddComponentTo<PositionComponent>(protagonist, PositionComponent{});
         benchmark::DoNotOptimize(ecs.template GetComponent<PositionComponent>(protagonist));
@@ -146,11 +157,230 @@ static void BM_Modify_One(benchmark::State& state)
 {
     ECS ecs;
     auto protagonist = CreateProtag(ecs);
+    PerfCounters perf(state);
     for ([[maybe_unused]] auto _: state) {
         PlotArmor(ecs, protagonist);
     }
 }
 
+// Steady-state worlds: holes in entity storage, toggled components, short query runs
+
+using ChurnRng = std::minstd_rand;
+
+template<typename ECS>
+static void RegisterChurnComponents(ECS& ecs)
+{
+    ecs.template RegisterComponents<
+        HealthComponent, PositionComponent, VelocityComponent,
+        SpreadComponent<0>, SpreadComponent<1>, SpreadComponent<2>, SpreadComponent<3>
+    >();
+}
+
+template<typename ECS>
+static typename ECS::Entity CreateMover(ECS& ecs, size_t i)
+{
+    if (i & 1) {
+        return ecs.CreateOneEntt(PositionComponent{}, VelocityComponent{});
+    } else {
+        return ecs.CreateOneEntt(PositionComponent{}, VelocityComponent{}, HealthComponent{100, 100});
+    }
+}
+
+template<typename ECS>
+static void RunMovers(ECS& ecs)
+{
+    ecs.template RunSystem<PositionComponent, VelocityComponent>([&](auto& pos, auto& dir){
+        updatePosition(pos, dir, 1.f/60.f);
+    });
+    ecs.template RunSystem<HealthComponent>(BITFUNC(updateHealth));
+}
+
+template<typename ECS>
+static void BM_Churn_Respawn(benchmark::State& state)
+{
+    size_t count = state.range(0);
+    size_t killed = count / 10;
+    ECS ecs;
+    RegisterChurnComponents(ecs);
+    ChurnRng rng(count);
+    std::vector<typename ECS::Entity> entts;
+    for (size_t i = 0; i < count; ++i) {
+        entts.push_back(CreateMover(ecs, i));
+    }
+    PerfCounters perf(state);
+    for ([[maybe_unused]] auto _: state) {
+        for (size_t i = 0; i < killed; ++i) {
+            size_t victim = rng() % entts.size();
+            ecs.DestroyEntt(entts[victim]);
+            entts[victim] = entts.back();
+            entts.pop_back();
+        }
+        for (size_t i = 0; i < killed; ++i) {
+            entts.push_back(CreateMover(ecs, rng()));
+        }
+        RunMovers(ecs);
+    }
+}
+
+template<typename ECS>
+static void BM_Churn_Toggle(benchmark::State& state)
+{
+    size_t count = state.range(0);
+    size_t toggled = count / 100 + 1;
+    ECS ecs;
+    RegisterChurnComponents(ecs);
+    ChurnRng rng(count);
+    std::vector<typename ECS::Entity> entts;
+    std::vector<bool> moving(count, true);
+    for (size_t i = 0; i < count; ++i) {
+        entts.push_back(CreateMover(ecs, i));
+    }
+    PerfCounters perf(state);
+    for ([[maybe_unused]] auto _: state) {
+        for (size_t i = 0; i < toggled; ++i) {
+            size_t target = rng() % count;
+            if (moving[target]) {
+                ecs.template RemoveComponentFrom<VelocityComponent>(entts[target]);
+            } else {
+                ecs.template AddComponentTo<VelocityComponent>(entts[target], VelocityComponent{});
+            }
+            moving[target] = !moving[target];
+        }
+        RunMovers(ecs);
+    }
+}
+
+template<typename ECS>
+static void BM_Spread_Groups(benchmark::State& state)
+{
+    size_t count = state.range(0);
+    ECS ecs;
+    RegisterChurnComponents(ecs);
+    ChurnRng rng(count);
+    for (size_t i = 0; i < count; ++i) {
+        // extra groups in between first and last -> query masks need adjusting
+        switch (rng() % 4) {
+        case 0: ecs.CreateOneEntt(SpreadComponent<0>{}, SpreadComponent<3>{}); break;
+        case 1: ecs.CreateOneEntt(SpreadComponent<0>{}, SpreadComponent<1>{}, SpreadComponent<3>{}); break;
+        case 2: ecs.CreateOneEntt(SpreadComponent<0>{}, SpreadComponent<2>{}, SpreadComponent<3>{}); break;
+        default: ecs.CreateOneEntt(SpreadComponent<0>{}, SpreadComponent<1>{},
+                                   SpreadComponent<2>{}, SpreadComponent<3>{}); break;
+        }
+    }
+    PerfCounters perf(state);
+    for ([[maybe_unused]] auto _: state) {
+        ecs.template RunSystem<SpreadComponent<0>, SpreadComponent<3>>([](auto& a, auto& b){
+            a.value += b.value;
+        });
+        ecs.template RunSystem<SpreadComponent<1>, SpreadComponent<2>>([](auto& a, auto& b){
+            a.value ^= b.value;
+        });
+        ecs.template RunSystem<SpreadComponent<0>, SpreadComponent<1>, SpreadComponent<2>, SpreadComponent<3>>(
+            [](auto& a, auto& b, auto& c, auto& d){
+                d.value = a.value + b.value + c.value;
+            });
+    }
+}
+
+// Large worlds: time + memory footprint
+
+// ECS, which have special storage for rare components (bitecs: sparse storage)
+template<typename ECS, typename = void>
+struct has_rare_components : std::false_type {};
+template<typename ECS>
+struct has_rare_components<ECS, std::void_t<decltype(&ECS::template RegisterRareComponents<DamageComponent>)>>
+    : std::true_type {};
+
+// memory growth from `base`, measured right after world creation (input arrays are already freed)
+static void ReportFootprint(benchmark::State& state, size_t base, size_t entts, size_t comps)
+{
+    size_t rss = MemoryUsage::TrimmedRss();
+    size_t peak = MemoryUsage::PeakRss();
+    if (!rss || rss < base) return;
+    double used = double(rss - base);
+    using benchmark::Counter;
+    state.counters["RSS"] = Counter(used, Counter::kDefaults, Counter::kIs1024);
+    if (peak > base) {
+        state.counters["peak_RSS"] = Counter(double(peak - base), Counter::kDefaults, Counter::kIs1024);
+    }
+    state.counters["bytes_per_entt"] = used / double(entts);
+    state.counters["bytes_per_comp"] = used / double(comps);
+}
+
+template<typename ECS, typename...Components>
+static void CreateInBatches(ECS& ecs, size_t count)
+{
+    constexpr size_t batch = 1 << 20;
+    for (size_t done = 0; done < count; done += batch) {
+        size_t n = std::min(batch, count - done);
+        std::tuple<std::vector<Components>...> init{std::vector<Components>(n)...};
+        ecs.CreateManyEntts(n, std::get<std::vector<Components>>(init).data()...);
+    }
+}
+
+template<typename ECS>
+static void BM_Large_World(benchmark::State& state)
+{
+    size_t count = state.range(0);
+    size_t base = MemoryUsage::TrimmedRss();
+    MemoryUsage::ResetPeak();
+    ECS ecs;
+    RegisterChurnComponents(ecs);
+    CreateInBatches<ECS, PositionComponent, VelocityComponent>(ecs, count / 2);
+    CreateInBatches<ECS, PositionComponent, VelocityComponent, HealthComponent>(ecs, count - count / 2);
+    ReportFootprint(state, base, count, count * 2 + (count - count / 2));
+    PerfCounters perf(state);
+    for ([[maybe_unused]] auto _: state) {
+        RunMovers(ecs);
+    }
+}
+
+// 0.1% of entts (created last -> highest indices) have DamageComponent
+template<typename ECS>
+static void BM_Large_Sparse(benchmark::State& state)
+{
+    size_t count = state.range(0);
+    size_t rare = count / 1000;
+    size_t base = MemoryUsage::TrimmedRss();
+    MemoryUsage::ResetPeak();
+    ECS ecs;
+    if constexpr (has_rare_components<ECS>::value) {
+        ecs.template RegisterComponents<PositionComponent>();
+        ecs.template RegisterRareComponents<DamageComponent>();
+    } else {
+        ecs.template RegisterComponents<PositionComponent, DamageComponent>();
+    }
+    CreateInBatches<ECS, PositionComponent>(ecs, count - rare);
+    for (size_t i = 0; i < rare; ++i) {
+        ecs.CreateOneEntt(PositionComponent{}, DamageComponent{1, 1});
+    }
+    ReportFootprint(state, base, count, count + rare);
+    PerfCounters perf(state);
+    for ([[maybe_unused]] auto _: state) {
+        ecs.template RunSystem<PositionComponent, DamageComponent>([](auto& pos, auto& dmg){
+            pos.x += float(dmg.atk);
+        });
+    }
+}
+
+static void LargeConfigurations(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"entts"});
+    const auto matrix = {5'000'000, 20'000'000};
+    for (long count: matrix) {
+        bench->Args({count});
+    }
+    // world is built on every run: do not let benchmark guess iterations
+    bench->Iterations(10)->Unit(benchmark::kMillisecond);
+}
+
+static void ChurnConfigurations(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"entts"});
+    const auto matrix = {2000, 30000, 200'000};
+    for (long count: matrix) {
+        bench->Args({count});
+    }
+}
+
 static void Configurations(benchmark::internal::Benchmark* bench) {
     bench->ArgNames({"datas", "heroes", "monsters"});
     const auto matrix = {10, 2000, 30000, 500'000};
@@ -159,13 +389,26 @@ static void Configurations(benchmark::internal::Benchmark* bench) {
     }
 }
 
+#define ECS_CHURN_BENCHMARKS(ECS) \
+BENCHMARK(BM_Churn_Respawn<ECS>)->Apply(ChurnConfigurations); \
+BENCHMARK(BM_Churn_Toggle<ECS>)->Apply(ChurnConfigurations); \
+BENCHMARK(BM_Spread_Groups<ECS>)->Apply(ChurnConfigurations)
+
+// millions of entts: not part of default test run (see bitecs_bench_large target)
+#define ECS_LARGE_BENCHMARKS(ECS) \
+BENCHMARK(BM_Large_World<ECS>)->Apply(LargeConfigurations); \
+BENCHMARK(BM_Large_Sparse<ECS>)->Apply(LargeConfigurations)
+
 #define ECS_BENCHMARKS_NO_CREATE(ECS) \
 BENCHMARK(BM_Add_Get_Remove<ECS>); \
 BENCHMARK(BM_Modify_One<ECS>); \
-BENCHMARK(BM_Systems<ECS>)->Apply(Configurations)
+BENCHMARK(BM_Systems<ECS>)->Apply(Configurations); \
+ECS_CHURN_BENCHMARKS(ECS)
 
 #define ECS_BENCHMARKS(ECS) \
 BENCHMARK(BM_Add_Get_Remove<ECS>); \
 BENCHMARK(BM_Modify_One<ECS>); \
 BENCHMARK(BM_Systems<ECS>)->Apply(Configurations); \
-BENCHMARK(BM_Create_Destroy<ECS>)->Apply(Configurations)
+BENCHMARK(BM_Create_Destroy<ECS>)->Apply(Configurations); \
+ECS_CHURN_BENCHMARKS(ECS); \
+ECS_LARGE_BENCHMARKS(ECS)
@@ -10,6 +10,11 @@ BITECS_COMPONENT(DamageComponent, 4);
 BITECS_COMPONENT(PositionComponent, 5);
 BITECS_COMPONENT(SpriteComponent, 6);
 BITECS_COMPONENT(VelocityComponent, 7);
+// one group each (group = id / BITECS_GROUP_SIZE)
+BITECS_COMPONENT(SpreadComponent<0>, 100);
+BITECS_COMPONENT(SpreadComponent<1>, 200);
+BITECS_COMPONENT(SpreadComponent<2>, 300);
+BITECS_COMPONENT(SpreadComponent<3>, 400);
 
 namespace bench0 {
 
@@ -23,6 +28,10 @@ struct Bitecs
     void RegisterComponents() {
         (reg.DefineComponent<Components>(bitecs_freq9) && ...);
     }
+    template<typename...Components>
+    void RegisterRareComponents() {
+        (reg.DefineSparseComponent<Components>() && ...);
+    }
 
     template<typename...Components>
     Entity CreateOneEntt(Components&&...c) {
@@ -48,6 +57,9 @@ struct Bitecs
     Component& GetComponent(Entity entt) {
         return reg.GetComponent<Component>(entt);
     }
+    void DestroyEntt(Entity entt) {
+        reg.Destroy(entt);
+    }
 };
 
 ECS_BENCHMARKS(Bitecs);
@@ -22,6 +22,12 @@ struct DataComponent {
 
 struct SmallComponent {int dummy;};
 
+// lives in its own group of ids (see bitecs.cpp) -> entts span up to 4 groups
+template<int Group>
+struct SpreadComponent {
+    int value{Group};
+};
+
 inline constexpr char PlayerSprite = '@';
 inline constexpr char MonsterSprite = 'k';
 inline constexpr char NPCSprite = 'h';
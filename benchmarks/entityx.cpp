@@ -47,6 +47,9 @@ struct EntityX
     Component& GetComponent(Entity entt) {
         return *entt.component<Component>();
     }
+    void DestroyEntt(Entity entt) {
+        entt.destroy();
+    }
 };
 
 ECS_BENCHMARKS(EntityX);
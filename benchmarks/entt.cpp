@@ -46,6 +46,9 @@ struct EnTT
     Component& GetComponent(Entity entt) {
         return registry.get<Component>(entt);
     }
+    void DestroyEntt(Entity entt) {
+        registry.destroy(entt);
+    }
 };
     
 ECS_BENCHMARKS(EnTT);
@@ -47,6 +47,9 @@ struct Flecs
     Component& GetComponent(Entity entt) {
         return *entt.get_ref<Component>().get();
     }
+    void DestroyEntt(Entity entt) {
+        entt.destruct();
+    }
 };
 
 ECS_BENCHMARKS(Flecs);
@@ -61,6 +61,9 @@ struct Gaia
     Component& GetComponent(Entity entt) {
         return w.set<Component>(entt);
     }
+    void DestroyEntt(Entity entt) {
+        w.del(entt);
+    }
 };
     
 ECS_BENCHMARKS(Gaia);
@@ -45,6 +45,9 @@ struct Ginseng
     Component& GetComponent(Entity entt) {
         return db.get_component<Component>(entt);
     }
+    void DestroyEntt(Entity entt) {
+        db.destroy_entity(entt);
+    }
 };
 
 ECS_BENCHMARKS(Ginseng);
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Resident memory of this process (/proc/self, Linux only). 0 if unknown
+struct MemoryUsage
+{
+    static size_t Rss() {
+        return ReadStatus("VmRSS:");
+    }
+    // give memory, freed by previous benchmarks, back to OS first. Otherwise it is reused without growing RSS
+    static size_t TrimmedRss() {
+#if defined(__GLIBC__)
+        malloc_trim(0);
+#endif
+        return Rss();
+    }
+    // high water mark since start or last ResetPeak()
+    static size_t PeakRss() {
+        return ReadStatus("VmHWM:");
+    }
+    static bool ResetPeak() {
+        FILE* f = std::fopen("/proc/self/clear_refs", "w");
+        if (!f) return false;
+        bool ok = std::fputs("5", f) >= 0;
+        return std::fclose(f) == 0 && ok;
+    }
+private:
+    static size_t ReadStatus(const char* key) {
+        FILE* f = std::fopen("/proc/self/status", "r");
+        if (!f) return 0;
+        char line[256];
+        size_t kb = 0;
+        size_t keylen = std::strlen(key);
+        while (std::fgets(line, sizeof(line), f)) {
+            if (std::strncmp(line, key, keylen) == 0) {
+                std::sscanf(line + keylen, "%zu", &kb);
+                break;
+            }
+        }
+        std::fclose(f);
+        return kb * 1024;
+    }
+};
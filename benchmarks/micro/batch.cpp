@@ -0,0 +1,85 @@
+#include <bitecs/bitecs.hpp>
+#include <benchmark/benchmark.h>
+#include "../perf_counters.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Random access by handles: one call per handle vs batched (sorted + prefetched) APIs
+
+namespace {
+
+struct BatchPos { float x, y, z; };
+struct BatchHp { int hp; };
+
+}
+
+BITECS_COMPONENT(BatchPos, 1);
+BITECS_COMPONENT(BatchHp, 300);
+
+namespace {
+
+struct World {
+    bitecs::Registry reg;
+    std::vector<bitecs::EntityPtr> handles;
+
+    World(size_t worldSize, size_t nhandles) {
+        reg.DefineComponent<BatchPos>(bitecs_freq9);
+        reg.DefineComponent<BatchHp>(bitecs_freq9);
+        std::vector<bitecs::EntityPtr> all;
+        all.reserve(worldSize);
+        for (size_t i = 0; i < worldSize; ++i) {
+            all.push_back(i & 1 ? reg.Entt(BatchPos{}) : reg.Entt(BatchPos{}, BatchHp{}));
+        }
+        std::minstd_rand rng(5);
+        for (size_t i = 0; i < nhandles; ++i) {
+            handles.push_back(all[rng() % worldSize]);
+        }
+    }
+};
+
+// world bigger than LLC is where visiting handles chunk by chunk pays off
+void Handles(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"entts", "handles"});
+    bench->Args({1 << 20, 256});
+    bench->Args({1 << 20, 50'000});
+    bench->Args({1 << 23, 1'000'000});
+}
+
+void BM_Get_Single(benchmark::State& state) {
+    World w(state.range(0), state.range(1));
+    PerfCounters perf(state);
+    for (auto _: state) {
+        for (auto h: w.handles) {
+            benchmark::DoNotOptimize(bitecs_entt_get_component(w.reg.Raw(), h, bitecs::component_id<BatchPos>));
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * w.handles.size()));
+}
+
+void BM_Get_Batch(benchmark::State& state) {
+    World w(state.range(0), state.range(1));
+    std::vector<BatchPos*> out(w.handles.size());
+    PerfCounters perf(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(w.reg.GetComponents(w.handles.data(), w.handles.size(), out.data()));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * w.handles.size()));
+}
+
+void BM_Gather(benchmark::State& state) {
+    World w(state.range(0), state.range(1));
+    std::vector<BatchPos> out(w.handles.size());
+    PerfCounters perf(state);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(w.reg.Gather(w.handles.data(), w.handles.size(), out.data()));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * w.handles.size()));
+}
+
+BENCHMARK(BM_Get_Single)->Apply(Handles);
+BENCHMARK(BM_Get_Batch)->Apply(Handles);
+BENCHMARK(BM_Gather)->Apply(Handles);
+
+}
@@ -0,0 +1,294 @@
+#include <bitecs/bitecs.hpp>
+#include <benchmark/benchmark.h>
+#include "../perf_counters.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Sparse mask primitives + query scans. Build with -DBITECS_MASK_PDEP=ON
+// and compare against default build (label shows which one is used)
+
+namespace {
+
+constexpr size_t poolSize = 1024;
+constexpr int idsPerGroup = 3;
+
+struct MaskCase {
+    std::vector<int> ids; // sorted
+    bitecs_SparseMask mask;
+    bitecs_Ranks ranks;
+};
+
+// pool of masks, each spanning exactly `groups` random groups
+std::vector<MaskCase> MakePool(int groups, unsigned seed = 42) {
+    std::minstd_rand rng(seed);
+    std::vector<MaskCase> pool(poolSize);
+    for (auto& c: pool) {
+        int picked[BITECS_BITS_IN_DICT];
+        for (int i = 0; i < BITECS_BITS_IN_DICT; ++i) picked[i] = i;
+        std::shuffle(picked, picked + BITECS_BITS_IN_DICT, rng);
+        for (int g = 0; g < groups; ++g) {
+            for (int j = 0; j < idsPerGroup; ++j) {
+                c.ids.push_back(picked[g] * BITECS_GROUP_SIZE + int(rng() % BITECS_GROUP_SIZE));
+            }
+        }
+        std::sort(c.ids.begin(), c.ids.end());
+        c.ids.erase(std::unique(c.ids.begin(), c.ids.end()), c.ids.end());
+        if (!bitecs_mask_from_array(&c.mask, c.ids.data(), unsigned(c.ids.size()))) std::abort();
+        bitecs_ranks_get(&c.ranks, c.mask.dict);
+    }
+    return pool;
+}
+
+void Groups(benchmark::internal::Benchmark* bench) {
+    bench->ArgName("groups")->DenseRange(1, BITECS_GROUPS_COUNT);
+}
+
+void BM_Mask_FromArray(benchmark::State& state) {
+    auto pool = MakePool(int(state.range(0)));
+    size_t i = 0;
+    for (auto _: state) {
+        auto& c = pool[i++ % poolSize];
+        bitecs_SparseMask mask;
+        benchmark::DoNotOptimize(bitecs_mask_from_array(&mask, c.ids.data(), unsigned(c.ids.size())));
+        benchmark::DoNotOptimize(mask);
+    }
+    state.SetLabel(bitecs_mask_impl());
+}
+
+void BM_Mask_IntoArray(benchmark::State& state) {
+    auto pool = MakePool(int(state.range(0)));
+    bitecs_BitsStorage storage;
+    size_t i = 0;
+    for (auto _: state) {
+        auto& c = pool[i++ % poolSize];
+        benchmark::DoNotOptimize(bitecs_mask_into_array(&c.mask, &c.ranks, storage));
+        benchmark::ClobberMemory();
+    }
+    state.SetLabel(bitecs_mask_impl());
+}
+
+// set all ids in random order (groups get inserted in the middle), then unset them
+void BM_Mask_SetUnset(benchmark::State& state) {
+    auto pool = MakePool(int(state.range(0)));
+    std::minstd_rand rng(7);
+    for (auto& c: pool) std::shuffle(c.ids.begin(), c.ids.end(), rng);
+    size_t i = 0;
+    size_t ops = 0;
+    for (auto _: state) {
+        auto& c = pool[i++ % poolSize];
+        bitecs_SparseMask mask{};
+        for (int id: c.ids) benchmark::DoNotOptimize(bitecs_mask_set(&mask, id, true));
+        for (int id: c.ids) benchmark::DoNotOptimize(bitecs_mask_set(&mask, id, false));
+        benchmark::DoNotOptimize(mask);
+        ops += c.ids.size() * 2;
+    }
+    state.SetItemsProcessed(int64_t(ops));
+    state.SetLabel(bitecs_mask_impl());
+}
+
+void BM_Mask_Get(benchmark::State& state) {
+    auto pool = MakePool(int(state.range(0)));
+    size_t i = 0;
+    for (auto _: state) {
+        auto& c = pool[i % poolSize];
+        // present and (most likely) absent id
+        benchmark::DoNotOptimize(bitecs_mask_get(&c.mask, c.ids[i % c.ids.size()]));
+        benchmark::DoNotOptimize(bitecs_mask_get(&c.mask, int(i % BITECS_MAX_COMPONENTS)));
+        ++i;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * 2);
+}
+
+void BM_Ranks_Get(benchmark::State& state) {
+    auto pool = MakePool(int(state.range(0)));
+    size_t i = 0;
+    for (auto _: state) {
+        bitecs_Ranks ranks;
+        bitecs_ranks_get(&ranks, pool[i++ % poolSize].mask.dict);
+        benchmark::DoNotOptimize(ranks);
+    }
+}
+
+// query with N groups relocated into entt with all 4 groups (N == 4 is a no-op)
+void BM_Mask_Adjust(benchmark::State& state) {
+    int qgroups = int(state.range(0));
+    auto entts = MakePool(BITECS_GROUPS_COUNT);
+    std::minstd_rand rng(3);
+    std::vector<MaskCase> queries(poolSize);
+    for (size_t i = 0; i < poolSize; ++i) {
+        auto& e = entts[i];
+        auto& q = queries[i];
+        // drop random groups of entt
+        bitecs_dict_t dict = e.mask.dict;
+        while (__builtin_popcountll(dict) > qgroups) {
+            int skip = int(rng() % unsigned(__builtin_popcountll(dict)));
+            bitecs_dict_t bit = dict;
+            while (skip--) bit &= bit - 1;
+            dict &= ~(bit & -bit);
+        }
+        for (int id: e.ids) {
+            if (dict & (bitecs_dict_t(1) << (id >> BITECS_GROUP_SHIFT))) q.ids.push_back(id);
+        }
+        if (!bitecs_mask_from_array(&q.mask, q.ids.data(), unsigned(q.ids.size()))) std::abort();
+        bitecs_ranks_get(&q.ranks, q.mask.dict);
+    }
+    size_t i = 0;
+    for (auto _: state) {
+        size_t at = i++ % poolSize;
+        auto& q = queries[at];
+        benchmark::DoNotOptimize(bitecs_mask_adjust(q.mask.dict, q.mask.bits, &q.ranks, entts[at].mask.dict));
+    }
+    state.SetLabel(bitecs_mask_impl());
+}
+
+BENCHMARK(BM_Mask_FromArray)->Apply(Groups);
+BENCHMARK(BM_Mask_IntoArray)->Apply(Groups);
+BENCHMARK(BM_Mask_SetUnset)->Apply(Groups);
+BENCHMARK(BM_Mask_Get)->Apply(Groups);
+BENCHMARK(BM_Ranks_Get)->Apply(Groups);
+BENCHMARK(BM_Mask_Adjust)->Apply(Groups);
+
+// query: A + B (groups 0 and 2). Pad (group 1) forces adjust, Other (group 4) is never queried
+struct ScanA { int v; };
+struct ScanB { int v; };
+struct ScanPad { int v; };
+struct ScanOther { int v; };
+
+}
+
+BITECS_COMPONENT(ScanA, 1);
+BITECS_COMPONENT(ScanB, 40);
+BITECS_COMPONENT(ScanPad, 20);
+BITECS_COMPONENT(ScanOther, 70);
+
+namespace {
+
+constexpr bitecs_index_t scanEntts = 1 << 16;
+
+void CountCallback(bitecs_udata udata, bitecs_CallbackContext*, bitecs_ptrs, bitecs_index_t count) {
+    *static_cast<size_t*>(udata) += count;
+}
+
+// runs of `run` matching entts, followed by `run` missing ones.
+// mixed: every other matching run has extra group in the middle (adjusted query)
+void FillScan(bitecs::Registry& reg, bitecs_index_t run, bool mixed) {
+    reg.DefineComponent<ScanA>(bitecs_freq9);
+    reg.DefineComponent<ScanB>(bitecs_freq9);
+    reg.DefineComponent<ScanPad>(bitecs_freq9);
+    reg.DefineComponent<ScanOther>(bitecs_freq9);
+    for (bitecs_index_t i = 0; i < scanEntts; ++i) {
+        bitecs_index_t block = i / run;
+        if (block & 1) {
+            (void)reg.Entt(ScanA{}, ScanOther{});
+        } else if (mixed && (block & 2)) {
+            (void)reg.Entt(ScanA{}, ScanPad{}, ScanB{});
+        } else {
+            (void)reg.Entt(ScanA{}, ScanB{});
+        }
+    }
+}
+
+void ScanArgs(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"run", "mixed"});
+    for (int64_t run: {1, 8, 64, 4096}) {
+        bench->Args({run, 0});
+        bench->Args({run, 1});
+    }
+}
+
+// per entt cost of bitecs_query_match + bitecs_query_miss
+void BM_Query_Scan(benchmark::State& state) {
+    bitecs::Registry reg;
+    FillScan(reg, bitecs_index_t(state.range(0)), state.range(1));
+    size_t matched = 0;
+    bitecs_SystemParams params = {};
+    params.comps = &bitecs::Components<ScanA, ScanB>::list;
+    params.system = CountCallback;
+    params.udata = &matched;
+    PerfCounters perf(state);
+    for (auto _: state) {
+        bitecs_system_run(reg.Raw(), &params);
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(int64_t(state.iterations()) * scanEntts);
+    state.SetLabel(bitecs_mask_impl());
+}
+
+// same, header-only loop (static_query + static_matcher)
+void BM_Query_Scan_Inline(benchmark::State& state) {
+    bitecs::Registry reg;
+    FillScan(reg, bitecs_index_t(state.range(0)), state.range(1));
+    size_t matched = 0;
+    PerfCounters perf(state);
+    for (auto _: state) {
+        reg.RunSystem<ScanA, ScanB>([&](ScanA&, ScanB&) {
+            matched++;
+        });
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(int64_t(state.iterations()) * scanEntts);
+}
+
+// same, pulled with bitecs_query_next() (no callback)
+void BM_Query_Pull(benchmark::State& state) {
+    bitecs::Registry reg;
+    FillScan(reg, bitecs_index_t(state.range(0)), state.range(1));
+    size_t matched = 0;
+    PerfCounters perf(state);
+    for (auto _: state) {
+        bitecs_query* query = bitecs_query_begin(reg.Raw(), &bitecs::Components<ScanA, ScanB>::list, 0, nullptr);
+        bitecs_QueryBatch batch;
+        while (bitecs_query_next(query, &batch)) {
+            matched += batch.count;
+        }
+        bitecs_query_end(query);
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(int64_t(state.iterations()) * scanEntts);
+    state.SetLabel(bitecs_mask_impl());
+}
+
+// one matching run over many small chunks: cost per entt must not grow with entts
+void BM_Query_Pull_Long(benchmark::State& state) {
+    bitecs::Registry reg;
+    reg.DefineComponent<ScanA>(bitecs_freq1);
+    reg.DefineComponent<ScanB>(bitecs_freq1);
+    auto entts = bitecs_index_t(state.range(0));
+    for (bitecs_index_t i = 0; i < entts; ++i) {
+        (void)reg.Entt(ScanA{}, ScanB{});
+    }
+    size_t matched = 0;
+    for (auto _: state) {
+        bitecs_query* query = bitecs_query_begin(reg.Raw(), &bitecs::Components<ScanA, ScanB>::list, 0, nullptr);
+        bitecs_QueryBatch batch;
+        while (bitecs_query_next(query, &batch)) {
+            matched += batch.count;
+        }
+        bitecs_query_end(query);
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(int64_t(state.iterations()) * entts);
+}
+
+// entity table only (bitecs_query_count), compare with counting system above
+void BM_Query_Count(benchmark::State& state) {
+    bitecs::Registry reg;
+    FillScan(reg, bitecs_index_t(state.range(0)), state.range(1));
+    size_t matched = 0;
+    PerfCounters perf(state);
+    for (auto _: state) {
+        matched += reg.Count<ScanA, ScanB>();
+    }
+    benchmark::DoNotOptimize(matched);
+    state.SetItemsProcessed(int64_t(state.iterations()) * scanEntts);
+    state.SetLabel(bitecs_mask_impl());
+}
+
+BENCHMARK(BM_Query_Scan)->Apply(ScanArgs);
+BENCHMARK(BM_Query_Scan_Inline)->Apply(ScanArgs);
+BENCHMARK(BM_Query_Pull)->Apply(ScanArgs);
+BENCHMARK(BM_Query_Pull_Long)->ArgName("entts")->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+BENCHMARK(BM_Query_Count)->Apply(ScanArgs);
+
+}
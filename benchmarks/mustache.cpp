@@ -50,6 +50,9 @@ struct Mustache
     Component& GetComponent(Entity entt) {
         return *world.entities().getComponent<Component>(entt);
     }
+    void DestroyEntt(Entity entt) {
+        world.entities().destroyNow(entt);
+    }
 };
 
 // Segfaults on lots of allocations
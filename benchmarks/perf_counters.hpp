@@ -0,0 +1,101 @@
+#pragma once
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters around benchmark loop (perf_event_open, Linux only).
+// Reported as per iteration user counters. Events, that can not be opened
+// (containers, perf_event_paranoid, VMs without PMU) are silently skipped.
+// BITECS_PERF=0 in environment disables them completely.
+class PerfCounters
+{
+public:
+    explicit PerfCounters(benchmark::State& state) : state(state) {
+#ifdef __linux__
+        const char* env = std::getenv("BITECS_PERF");
+        if (env && std::strcmp(env, "0") == 0) return;
+        for (auto& ev: events) {
+            ev.fd = Open(ev.type, ev.config);
+        }
+        for (auto& ev: events) {
+            if (ev.fd >= 0) ioctl(ev.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (auto& ev: events) {
+            if (ev.fd >= 0) ioctl(ev.fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        double cycles = 0, instructions = 0;
+        for (auto& ev: events) {
+            if (ev.fd < 0) continue;
+            double value;
+            if (Read(ev.fd, value) && state.iterations()) {
+                state.counters[ev.name] = benchmark::Counter(value, benchmark::Counter::kAvgIterations);
+                if (ev.config == PERF_COUNT_HW_CPU_CYCLES && ev.type == PERF_TYPE_HARDWARE) cycles = value;
+                if (ev.config == PERF_COUNT_HW_INSTRUCTIONS && ev.type == PERF_TYPE_HARDWARE) instructions = value;
+            }
+            close(ev.fd);
+        }
+        if (cycles > 0 && instructions > 0) {
+            state.counters["IPC"] = instructions / cycles;
+        }
+#endif
+    }
+private:
+    benchmark::State& state;
+#ifdef __linux__
+    static constexpr uint64_t CacheReadMiss(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+    struct Event {
+        const char* name;
+        uint32_t type;
+        uint64_t config;
+        int fd = -1;
+    };
+    Event events[6] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"branch_miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {"L1d_miss", PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_L1D)},
+        {"LLC_miss", PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_LL)},
+        {"dTLB_miss", PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_DTLB)},
+    };
+
+    // not grouped: PMU may not fit all of them at once -> kernel multiplexes, we scale back
+    static int Open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static bool Read(int fd, double& out) {
+        uint64_t data[3]; // value, time enabled, time running
+        if (read(fd, data, sizeof(data)) != sizeof(data) || !data[2]) {
+            return false;
+        }
+        out = double(data[0]) * double(data[1]) / double(data[2]);
+        return true;
+    }
+#endif
+};
@@ -6,8 +6,13 @@
 #include "bitecs_impl.hpp"
 #include <cstddef>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <stdexcept>
+#include <tuple>
 #include <utility>
+#include <vector>
 #include <cassert>
 #include <climits>
 #include "bitecs_core.h"
@@ -35,8 +40,8 @@ class Components
     static constexpr int size = sizeof...(Comps);
     static_assert(impl::count_groups(data, size) <= BITECS_GROUPS_COUNT);
 public:
-    static inline bitecs_ComponentsList list = {
-        SparseMask(sorted.data(), size).mask, data, size
+    static constexpr bitecs_ComponentsList list = {
+        impl::mask_from_sorted(sorted), data, size
     };
 };
 
@@ -60,10 +65,122 @@ struct Func : FuncBase<func, decltype(func)>
 template<typename Fn>
 using if_not_function_ptr = std::enable_if_t<!std::is_function_v<Fn> && "Use BITFUNC(f)">;
 
+struct RegistryStats : bitecs_RegistryStats
+{
+    RegistryStats() : bitecs_RegistryStats{} {}
+    RegistryStats(RegistryStats const&) = delete;
+    RegistryStats(RegistryStats&& o) : bitecs_RegistryStats(o) {
+        o.components = nullptr;
+        o.archetypes = nullptr;
+    }
+    ~RegistryStats() {
+        bitecs_registry_stats_free(this);
+    }
+};
+
+class ThreadPool
+{
+    bitecs_threadpool* pool;
+public:
+    // see bitecs_threadpool_new()
+    explicit ThreadPool(size_t nthreads) : pool(bitecs_threadpool_new(nthreads)) {
+        if (!pool) {
+            throw std::runtime_error("Could not create threadpool");
+        }
+    }
+    ThreadPool(ThreadPool const&) = delete;
+    ~ThreadPool() {
+        bitecs_threadpool_delete(pool);
+    }
+
+    bitecs_threadpool* Raw() {
+        return pool;
+    }
+
+    size_t Size() {
+        return bitecs_threadpool_size(pool);
+    }
+};
+
+// 0 for calling thread, 1+ for threadpool workers
+inline int CurrentWorker() {
+    return bitecs_current_worker();
+}
+
+template<typename...Fns>
+class SystemGraph;
+
+class Schema;
+
+// see bitecs_system_run_begin(). Must be destroyed before registry
+template<typename Fn, typename...Comps>
+class ResumableSystem
+{
+    // stable address for udata: handle may be moved
+    std::unique_ptr<Fn> fn;
+    bitecs_run* run = nullptr;
+public:
+    ResumableSystem(bitecs_registry* reg, Fn&& system, bitecs_flags_t flags)
+        : fn(std::make_unique<Fn>(std::move(system)))
+    {
+        using thunk = impl::system_thunk<Fn, std::index_sequence_for<Comps...>, Comps...>;
+        bitecs_SystemParams params = {};
+        params.flags = flags;
+        params.comps = &Components<Comps...>::list;
+        params.system = thunk::call;
+        params.udata = fn.get();
+#ifdef BITECS_PROFILE
+        params.name = impl::system_name<Fn>();
+#endif
+        run = bitecs_system_run_begin(reg, &params);
+        if (!run) {
+            throw std::runtime_error("Could not begin system run");
+        }
+    }
+    ResumableSystem(ResumableSystem&& o) : fn(std::move(o.fn)), run(std::exchange(o.run, nullptr)) {}
+    ResumableSystem(ResumableSystem const&) = delete;
+    ~ResumableSystem() {
+        bitecs_system_run_end(run);
+    }
+
+    // true: all matches are processed
+    bool Resume(index_t maxEntts, uint64_t maxNs = 0) {
+        return bitecs_system_run_resume(run, maxEntts, maxNs);
+    }
+
+    void Restart() {
+        bitecs_system_run_restart(run);
+    }
+
+    index_t Cursor() {
+        return bitecs_system_run_cursor(run);
+    }
+};
+
 class Registry
 {
     bitecs_registry* reg;
 
+    template<typename...> friend class SystemGraph;
+    friend class Schema;
+
+    explicit Registry(bitecs_registry* raw) : reg(raw) {}
+
+    template<typename T>
+    static bitecs_ComponentMeta MetaFor(bitecs_Frequency freq) {
+        bitecs_ComponentMeta meta {std::is_empty_v<T> ? 0 : sizeof(T), freq, nullptr};
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            meta.deleter = impl::deleter_for<T>;
+        }
+        if constexpr (!std::is_trivially_move_constructible_v<T>) {
+            meta.relocater = impl::relocater_for<T>;
+        }
+        if constexpr (!std::is_trivially_copyable_v<T> && std::is_copy_constructible_v<T>) {
+            meta.copier = impl::copier_for<T>;
+        }
+        return meta;
+    }
+
     template<typename...Comps, typename Fn>
     void DoEntts(index_t count, Fn& populate, TypeList<Comps...> = {})
     {
@@ -74,16 +191,58 @@ class Registry
         }
     }
 
+    // Same as bitecs_system_run(), but match/miss scan is specialized for this query
+    // and batches are passed to system without indirect calls
     template<typename...Comps, typename Fn>
     void DoRunSystem(bitecs_flags_t flags, Fn& f, TypeList<Comps...> = {}) {
-        using seq = std::index_sequence_for<Comps...>;
-        constexpr auto* system = impl::system_thunk<Fn, seq, Comps...>::call;
-        bitecs_SystemParams params = {};
-        params.comps = &Components<Comps...>::list;
-        params.system = system;
-        params.flags = flags;
-        params.udata = &f;
-        bitecs_system_run(reg, &params);
+        if constexpr (sizeof...(Comps) != 0) {
+            using seq = std::index_sequence_for<Comps...>;
+            using system = impl::system_thunk<Fn, seq, Comps...>;
+            using comps = Components<Comps...>;
+            constexpr uint64_t writes = impl::writes_mask<Fn, Comps...>();
+            impl::static_matcher<impl::static_query<Comps...>> matcher{flags};
+            index_t count;
+            Entity* entts = bitecs_registry_entities(reg, &count);
+#ifdef BITECS_PROFILE
+            bitecs_SystemTrace trace = {};
+            trace.name = impl::system_name<Fn>();
+            trace.scanned = count;
+            trace.begin_ns = bitecs_profile_now();
+#endif
+            void* ptrs[sizeof...(Comps)];
+            CallbackContext ctx;
+            index_t cursor = 0;
+            while (true) {
+                index_t offset = impl::query_match(matcher, cursor, entts, count);
+                if (offset == count) break;
+                index_t end = impl::query_miss(matcher, offset, entts, count);
+                while (end > offset) {
+                    index_t selected = bitecs_components_select_writes(
+                        reg, comps::list.components, comps::list.ncomps, writes, offset, end - offset, ptrs);
+                    if (!selected) {
+                        throw std::runtime_error("Could not copy chunk of forked registry");
+                    }
+                    ctx.index = offset;
+                    ctx.entts = reinterpret_cast<EntityProxy*>(entts) + offset;
+                    system::call(&f, &ctx, ptrs, selected);
+                    offset += selected;
+#ifdef BITECS_PROFILE
+                    trace.matched += selected;
+                    trace.runs++;
+#endif
+                }
+                cursor = end;
+            }
+#ifdef BITECS_PROFILE
+            trace.end_ns = bitecs_profile_now();
+            bitecs_profile_record(reg, &trace);
+#endif
+        }
+    }
+
+    template<typename Fn, typename...Comps>
+    ResumableSystem<Fn, Comps...> MakeResumable(Fn&& f, bitecs_flags_t flags, TypeList<Comps...>) {
+        return ResumableSystem<Fn, Comps...>(reg, std::move(f), flags);
     }
 
 public:
@@ -93,26 +252,86 @@ public:
     Registry() {
         reg = bitecs_registry_new();
     }
+
+    // see bitecs_registry_new_with()
+    explicit Registry(const bitecs_Allocator& alloc) {
+        reg = bitecs_registry_new_with(&alloc);
+    }
+
+    // see bitecs_registry_new_schema()
+    explicit Registry(const Schema& schema, const bitecs_Allocator* alloc = nullptr);
+
+    // see bitecs_registry_new_mapped()
+    static Registry Mapped(const char* path, size_t capacity) {
+        bitecs_registry* raw = bitecs_registry_new_mapped(path, capacity);
+        if (!raw) {
+            throw std::runtime_error("Could not map registry file");
+        }
+        return Registry(raw);
+    }
+
+    // see bitecs_registry_open_mapped()
+    static Registry OpenMapped(const char* path) {
+        bitecs_registry* raw = bitecs_registry_open_mapped(path);
+        if (!raw) {
+            throw std::runtime_error("Could not reopen registry file");
+        }
+        return Registry(raw);
+    }
     ~Registry() {
         bitecs_registry_delete(reg);
     }
 
+    // see bitecs_registry_fork()
+    Registry Fork() {
+        bitecs_registry* raw = bitecs_registry_fork(reg);
+        if (!raw) {
+            throw std::runtime_error("Could not fork registry");
+        }
+        return Registry(raw);
+    }
+
+    bitecs_registry* Raw() {
+        return reg;
+    }
+
+    void SetPlacement(bitecs_Placement placement) {
+        bitecs_registry_set_placement(reg, placement);
+    }
+
     EntityProxy* Deref(EntityPtr ptr) {
         return bitecs_entt_deref(reg, ptr);
     }
 
     template<typename T>
-    bool DefineComponent(bitecs_Frequency freq = bitecs_Frequency::bitecs_freq5) {
-        bitecs_ComponentMeta meta {std::is_empty_v<T> ? 0 : sizeof(T), freq, nullptr};
-        if constexpr (!std::is_trivially_destructible_v<T>) {
-            meta.deleter = impl::deleter_for<T>;
-        }
-        if constexpr (!std::is_trivially_move_constructible_v<T>) {
-            meta.relocater = impl::relocater_for<T>;
-        }
+    bool DefineComponent(bitecs_Frequency freq = bitecs_Frequency::bitecs_freq5, bool autoFrequency = false) {
+        bitecs_ComponentMeta meta = MetaFor<T>(freq);
+        meta.auto_frequency = autoFrequency;
         return bitecs_component_define(reg, component_id<T>, meta);
     }
 
+    // For components, present on tiny part of entts
+    template<typename T>
+    bool DefineSparseComponent() {
+        bitecs_ComponentMeta meta = MetaFor<T>(bitecs_freq1);
+        meta.storage = bitecs_storage_sparse;
+        return bitecs_component_define(reg, component_id<T>, meta);
+    }
+
+    // Systems, that read T, see it as of last SwapBuffers() (see bitecs_storage_double_buffered)
+    template<typename T>
+    bool DefineDoubleBufferedComponent(bitecs_Frequency freq = bitecs_Frequency::bitecs_freq5) {
+        static_assert(std::is_trivially_copyable_v<T> && !std::is_empty_v<T>);
+        bitecs_ComponentMeta meta = MetaFor<T>(freq);
+        meta.storage = bitecs_storage_double_buffered;
+        return bitecs_component_define(reg, component_id<T>, meta);
+    }
+
+    template<typename...Comps>
+    void SwapBuffers() {
+        (bitecs_component_swap(reg, component_id<Comps>), ...);
+    }
+
     template<typename...Comps, typename Fn, typename = if_not_function_ptr<Fn>>
     void RunSystem(bitecs_flags_t flags, Fn& f) {
         if constexpr (sizeof...(Comps) == 0) {
@@ -172,6 +391,13 @@ public:
         return res;
     }
 
+    // see bitecs_entt_instantiate()
+    void Instantiate(EntityPtr prefab, index_t count, EntityPtr* out = nullptr) {
+        if (!bitecs_entt_instantiate(reg, prefab, count, out)) {
+            throw std::runtime_error("Could not instantiate prefab");
+        }
+    }
+
     void Destroy(EntityPtr entt) {
         bitecs_entt_destroy(reg, entt);
     }
@@ -180,6 +406,23 @@ public:
         bitecs_entt_destroy_batch(reg, entt, count);
     }
 
+    template<typename...Comps>
+    index_t DestroyMatching(bitecs_flags_t flags = 0) {
+        return bitecs_entt_destroy_matching(reg, &Components<Comps...>::list, flags);
+    }
+
+    // see bitecs_query_count()
+    template<typename...Comps>
+    index_t Count(bitecs_flags_t flags = 0) {
+        return bitecs_query_count(reg, &Components<Comps...>::list, flags);
+    }
+
+    // see bitecs_query_collect()
+    template<typename...Comps>
+    index_t Collect(EntityPtr* out, size_t cap, bitecs_flags_t flags = 0) {
+        return bitecs_query_collect(reg, &Components<Comps...>::list, flags, out, cap);
+    }
+
     template<typename Comp, typename...Args>
     Comp& AddComponent(EntityPtr entt, Args&&...args) {
         auto* c = static_cast<Comp*>(bitecs_entt_add_component(reg, entt, component_id<Comp>));
@@ -189,6 +432,24 @@ public:
         return *(new (c) Comp(std::forward<Args>(args)...));
     }
 
+    // out[i] = nullptr for stale ptrs and entts without component. returns N found
+    template<typename Comp>
+    index_t GetComponents(const EntityPtr* entts, size_t count, Comp** out) {
+        return bitecs_components_get_batch(reg, component_id<Comp>, entts, count, reinterpret_cast<void**>(out));
+    }
+
+    template<typename Comp>
+    index_t Gather(const EntityPtr* entts, size_t count, Comp* out) {
+        static_assert(std::is_trivially_copyable_v<Comp>, "Gather() copies raw bytes");
+        return bitecs_components_gather(reg, component_id<Comp>, entts, count, out);
+    }
+
+    template<typename Comp>
+    index_t Scatter(const EntityPtr* entts, size_t count, const Comp* in) {
+        static_assert(std::is_trivially_copyable_v<Comp>, "Scatter() copies raw bytes");
+        return bitecs_components_scatter(reg, component_id<Comp>, entts, count, in);
+    }
+
     template<typename Comp>
     Comp& GetComponent(EntityPtr entt) {
         auto* c = static_cast<Comp*>(bitecs_entt_get_component(reg, entt, component_id<Comp>));
@@ -198,6 +459,16 @@ public:
         return *c;
     }
 
+    // double-buffered: previous value
+    template<typename Comp>
+    const Comp& ReadComponent(EntityPtr entt) {
+        auto* c = static_cast<const Comp*>(bitecs_entt_read_component(reg, entt, component_id<Comp>));
+        if (!c) {
+            throw std::runtime_error("Could not read component");
+        }
+        return *c;
+    }
+
     template<typename Comp>
     void RemoveComponent(EntityPtr entt) {
         if (!bitecs_entt_remove_component(reg, entt, component_id<Comp>)) {
@@ -205,6 +476,37 @@ public:
         }
     }
 
+    template<typename T>
+    bitecs_ComponentStats Stats() {
+        bitecs_ComponentStats res;
+        if (!bitecs_component_stats(reg, component_id<T>, &res)) {
+            throw std::runtime_error("Could not get component stats");
+        }
+        return res;
+    }
+
+    RegistryStats Stats() {
+        RegistryStats res;
+        if (!bitecs_registry_stats(reg, &res)) {
+            throw std::runtime_error("Could not get registry stats");
+        }
+        return res;
+    }
+
+    template<typename T>
+    void Rechunk(bitecs_Frequency freq) {
+        if (!bitecs_component_rechunk(reg, component_id<T>, freq)) {
+            throw std::runtime_error("Could not rechunk component");
+        }
+    }
+
+    // see bitecs_profile_enable()
+    void EnableProfiling(size_t capacity) {
+        if (!bitecs_profile_enable(reg, capacity)) {
+            throw std::runtime_error("Could not enable profiling");
+        }
+    }
+
     bitecs_cleanup_data* PrepareCleanup() {
         return bitecs_cleanup_prepare(reg);
     }
@@ -218,6 +520,308 @@ public:
             throw std::runtime_error("Could not merge other registry");
         }
     }
+
+    // see bitecs_entt_transfer()
+    size_t TransferTo(Registry& dst, const EntityPtr* entts, size_t count, EntityPtr* out = nullptr) {
+        return bitecs_entt_transfer(reg, dst.reg, entts, count, out);
+    }
+
+    // System, that is run in slices: while (!sys.Resume(10000)) {...}
+    template<typename...Comps, typename Fn, typename = if_not_function_ptr<Fn>>
+    auto Resumable(Fn&& f, bitecs_flags_t flags = 0) {
+        using System = std::decay_t<Fn>;
+        if constexpr (sizeof...(Comps) == 0) {
+            using args = impl::deduce_args_t<System>;
+            static_assert(!std::is_void_v<args>, "Could not deduce components: specify them explicitly");
+            return MakeResumable(System(std::forward<Fn>(f)), flags, args{});
+        } else {
+            return ResumableSystem<System, Comps...>(reg, System(std::forward<Fn>(f)), flags);
+        }
+    }
+
+    // Build graph of systems: reg.Schedule().Add(sys1).Add(sys2)...Run(pool)
+    SystemGraph<> Schedule();
+};
+
+// Systems with access sets, deduced from signatures (const T& - read, T& - write).
+// System goes one level after last earlier system, it conflicts with. Systems of one level
+// run in parallel (one task per system), levels are separated by barrier. Levels are computed
+// at compile time. Systems must not create/destroy entts or add/remove components
+template<typename...Fns>
+class SystemGraph
+{
+    template<typename...> friend class SystemGraph;
+    friend class Registry;
+
+    static constexpr size_t count = sizeof...(Fns);
+    static constexpr std::array<impl::AccessSet, count> access = {impl::access_of<Fns>...};
+    static constexpr std::array<size_t, count> levels = []{
+        std::array<size_t, count> res = {};
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (res[j] >= res[i] && access[i].ConflictsWith(access[j])) {
+                    res[i] = res[j] + 1;
+                }
+            }
+        }
+        return res;
+    }();
+    static constexpr size_t nlevels = []{
+        size_t res = 0;
+        for (size_t level: levels) {
+            if (level + 1 > res) res = level + 1;
+        }
+        return res;
+    }();
+    // systems, sorted by level. Level i is [begins[i]; begins[i + 1])
+    static constexpr std::array<size_t, count> order = []{
+        std::array<size_t, count> res = {};
+        size_t n = 0;
+        for (size_t level = 0; level < nlevels; ++level) {
+            for (size_t i = 0; i < count; ++i) {
+                if (levels[i] == level) res[n++] = i;
+            }
+        }
+        return res;
+    }();
+    static constexpr std::array<size_t, count + 1> begins = []{
+        std::array<size_t, count + 1> res = {};
+        for (size_t level = 0; level < nlevels; ++level) {
+            res[level + 1] = res[level];
+            for (size_t l: levels) {
+                if (l == level) res[level + 1]++;
+            }
+        }
+        return res;
+    }();
+
+    Registry& reg;
+    std::tuple<Fns...> systems;
+    std::array<flags_t, count> flags;
+
+    SystemGraph(Registry& reg, std::tuple<Fns...>&& systems, std::array<flags_t, count> flags)
+        : reg(reg), systems(std::move(systems)), flags(flags)
+    {}
+
+    struct Batch {
+        SystemGraph* self;
+        const size_t* systems;
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+    };
+
+    template<size_t I>
+    static void RunOne(SystemGraph& self) {
+        using Fn = std::tuple_element_t<I, std::tuple<Fns...>>;
+        self.reg.DoRunSystem(self.flags[I], std::get<I>(self.systems), impl::deduce_args_t<Fn>{});
+    }
+
+    template<size_t...Is>
+    void RunLevels(bitecs_threadpool* pool, std::index_sequence<Is...>) {
+        if constexpr (count != 0) {
+            static constexpr void(*thunks[])(SystemGraph&) = {&SystemGraph::RunOne<Is>...};
+            index_t entts;
+            (void)bitecs_registry_entities(reg.Raw(), &entts);
+            for (size_t level = 0; level < nlevels; ++level) {
+                Batch batch{this, order.data() + begins[level]};
+                bitecs_threadpool_run(pool, [](void* udata, size_t task) {
+                    auto& batch = *static_cast<Batch*>(udata);
+                    try {
+                        thunks[batch.systems[task]](*batch.self);
+                    } catch (...) {
+                        if (!batch.failed.exchange(true)) {
+                            batch.error = std::current_exception();
+                        }
+                    }
+                }, &batch, begins[level + 1] - begins[level]);
+                if (batch.error) {
+                    std::rethrow_exception(batch.error);
+                }
+            }
+        }
+    }
+public:
+    template<typename Fn>
+    SystemGraph<Fns..., std::decay_t<Fn>> Add(Fn&& system, flags_t systemFlags = 0) && {
+        using Sys = std::decay_t<Fn>;
+        static_assert(!std::is_void_v<impl::deduce_args_t<Sys>>, "System must have plain (non-template) signature");
+        std::array<flags_t, count + 1> newFlags = {};
+        for (size_t i = 0; i < count; ++i) newFlags[i] = flags[i];
+        newFlags[count] = systemFlags;
+        return SystemGraph<Fns..., Sys>(
+            reg, std::tuple_cat(std::move(systems), std::tuple<Sys>(std::forward<Fn>(system))), newFlags);
+    }
+
+    static constexpr size_t Level(size_t system) {
+        return levels[system];
+    }
+
+    static constexpr size_t LevelsCount() {
+        return nlevels;
+    }
+
+    // pool may be NULL (run serially, in order of levels)
+    void Run(bitecs_threadpool* pool = nullptr) {
+        RunLevels(pool, std::index_sequence_for<Fns...>{});
+    }
+
+    void Run(ThreadPool& pool) {
+        Run(pool.Raw());
+    }
+};
+
+inline SystemGraph<> Registry::Schedule() {
+    return SystemGraph<>(*this, {}, {});
+}
+
+// see bitecs_schema_new(). Components can only be defined, until first registry is created from it
+class Schema
+{
+    bitecs_schema* schema;
+public:
+    Schema() : schema(bitecs_schema_new()) {
+        if (!schema) {
+            throw std::runtime_error("Could not create schema");
+        }
+    }
+    Schema(Schema const& o) : schema(bitecs_schema_retain(o.schema)) {}
+    Schema(Schema&& o) : schema(std::exchange(o.schema, nullptr)) {}
+    ~Schema() {
+        bitecs_schema_release(schema);
+    }
+
+    bitecs_schema* Raw() const {
+        return schema;
+    }
+
+    template<typename T>
+    bool DefineComponent(bitecs_Frequency freq = bitecs_Frequency::bitecs_freq5, bool autoFrequency = false) {
+        bitecs_ComponentMeta meta = Registry::MetaFor<T>(freq);
+        meta.auto_frequency = autoFrequency;
+        return bitecs_schema_define(schema, component_id<T>, meta);
+    }
+
+    template<typename T>
+    bool DefineSparseComponent() {
+        bitecs_ComponentMeta meta = Registry::MetaFor<T>(bitecs_freq1);
+        meta.storage = bitecs_storage_sparse;
+        return bitecs_schema_define(schema, component_id<T>, meta);
+    }
+
+    template<typename T>
+    bool DefineDoubleBufferedComponent(bitecs_Frequency freq = bitecs_Frequency::bitecs_freq5) {
+        static_assert(std::is_trivially_copyable_v<T> && !std::is_empty_v<T>);
+        bitecs_ComponentMeta meta = Registry::MetaFor<T>(freq);
+        meta.storage = bitecs_storage_double_buffered;
+        return bitecs_schema_define(schema, component_id<T>, meta);
+    }
+};
+
+inline Registry::Registry(const Schema& schema, const bitecs_Allocator* alloc) {
+    reg = bitecs_registry_new_schema(schema.Raw(), alloc);
+    if (!reg) {
+        throw std::runtime_error("Could not create registry");
+    }
+}
+
+// see bitecs_world_new(). Shards are owned by world
+class World
+{
+    Schema schema;
+    std::vector<Registry> shards;
+    bitecs_world* world = nullptr;
+
+    template<typename Fn>
+    struct Fanout {
+        World* self;
+        Fn* fn;
+        flags_t flags;
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+    };
+public:
+    // components are defined in schema beforehand (it is shared by all shards)
+    World(const Schema& schema, size_t nshards) : schema(schema) {
+        shards.reserve(nshards);
+        std::vector<bitecs_registry*> raw;
+        for (size_t i = 0; i < nshards; ++i) {
+            raw.push_back(shards.emplace_back(schema).Raw());
+        }
+        world = bitecs_world_new(raw.data(), nshards);
+        if (!world) {
+            throw std::runtime_error("Could not create world");
+        }
+    }
+    World(World const&) = delete;
+    ~World() {
+        bitecs_world_delete(world);
+    }
+
+    bitecs_world* Raw() {
+        return world;
+    }
+
+    size_t ShardsCount() {
+        return shards.size();
+    }
+
+    Registry& Shard(size_t shard) {
+        return shards[shard];
+    }
+
+    void SetPartition(bitecs_Partition partition, void* udata = nullptr) {
+        bitecs_world_set_partition(world, partition, udata);
+    }
+
+    template<typename...Comps>
+    ShardPtr Entt(uint64_t key, Comps...comps) {
+        size_t shard = bitecs_world_route(world, key);
+        return {shards[shard].Entt(std::move(comps)...), uint32_t(shard)};
+    }
+
+    void Destroy(ShardPtr entt) {
+        shards[entt.shard].Destroy(entt.ptr);
+    }
+
+    template<typename Comp>
+    Comp& GetComponent(ShardPtr entt) {
+        return shards[entt.shard].GetComponent<Comp>(entt.ptr);
+    }
+
+    template<typename...Comps>
+    uint64_t Count(bitecs_flags_t flags = 0) {
+        return bitecs_world_query_count(world, &Components<Comps...>::list, flags);
+    }
+
+    // system runs on all shards in parallel (see Registry::RunSystem()), so it must be thread safe.
+    // Current shard: bitecs_current_shard()
+    template<typename...Comps, typename Fn>
+    void RunSystem(bitecs_threadpool* pool, Fn&& f, bitecs_flags_t flags = 0) {
+        using Sys = std::remove_reference_t<Fn>;
+        Fanout<Sys> ctx{this, &f, flags};
+        bitecs_world_run(world, pool, [](void* udata, size_t shard) {
+            auto& ctx = *static_cast<Fanout<Sys>*>(udata);
+            try {
+                ctx.self->shards[shard].template RunSystem<Comps...>(ctx.flags, *ctx.fn);
+            } catch (...) {
+                if (!ctx.failed.exchange(true)) {
+                    ctx.error = std::current_exception();
+                }
+            }
+        }, &ctx);
+        if (ctx.error) {
+            std::rethrow_exception(ctx.error);
+        }
+    }
+
+    template<typename...Comps, typename Fn>
+    void RunSystem(ThreadPool& pool, Fn&& f, bitecs_flags_t flags = 0) {
+        RunSystem<Comps...>(pool.Raw(), std::forward<Fn>(f), flags);
+    }
+
+    void Cleanup(bitecs_threadpool* pool = nullptr) {
+        bitecs_world_cleanup(world, pool);
+    }
 };
 
 
@@ -84,14 +84,75 @@ void bitecs_ranks_get(bitecs_Ranks* out, bitecs_dict_t dict);
 
 typedef struct bitecs_registry bitecs_registry;
 
+typedef enum {
+    // registry itself, per component bookkeeping
+    bitecs_alloc_registry,
+    // component chunks: fixed size per component (see bitecs_ComponentStats::frequency)
+    bitecs_alloc_chunk,
+    // entity table: grows by 1.7x
+    bitecs_alloc_entities,
+    // small nodes and tables: free list, chunk tables, sparse pages + dense arrays
+    bitecs_alloc_index,
+    // scratch and per-registry buffers: cleanup data, queries, batch sorting, profiling traces
+    bitecs_alloc_temp,
+} bitecs_AllocKind;
+
+typedef struct {
+    // align is power of 2. NULL on failure
+    void* (*alloc)(void* udata, size_t size, size_t align, bitecs_AllocKind kind);
+    // same size, align and kind, as were passed to alloc
+    void (*free)(void* udata, void* ptr, size_t size, size_t align, bitecs_AllocKind kind);
+    void* udata;
+} bitecs_Allocator;
+
+// malloc/free (aligned_alloc for over-aligned requests)
+const bitecs_Allocator* bitecs_allocator_default(void);
+
+// Chunks (that are at least a page) are carved out of large per-node mappings and are never
+// recycled through heap. node < 0: page is placed on node of the thread, that touches it first
+// (MPOL_LOCAL), i.e. the one that creates entts (or adds components) in that chunk: to place chunks
+// near their workers, create entts from worker tasks. Otherwise page is bound to node.
+// Everything else goes to default allocator. Allocators of same node share pool (thread safe).
+// false if built without BITECS_NUMA or NUMA is not available
+_BITECS_NODISCARD
+bool bitecs_allocator_numa(bitecs_Allocator* out, int node);
+
 _BITECS_NODISCARD
 bitecs_registry* bitecs_registry_new(void);
+// alloc is copied (udata must outlive registry). NULL: default
+_BITECS_NODISCARD
+bitecs_registry* bitecs_registry_new_with(const bitecs_Allocator* alloc);
 void bitecs_registry_delete(bitecs_registry* reg);
 
+// Chunks and entity table are allocated from new file at path (existing one is not overwritten), mapped
+// with MAP_SHARED: cold chunks are paged out by OS. Chunks up to few pages are packed together (their slots
+// are recycled in file), larger ones, freed by bitecs_cleanup(), are punched out of file.
+// capacity: max file size (address space is reserved upfront, disk blocks - on allocation).
+// Plain data only: components with deleter/relocater/copier or not chunked storage can't be defined.
+// bitecs_registry_delete() writes rest of registry into file, so world survives restart without load step
+// (file is not reopenable after crash or if it got full). NULL if unsupported/exists/could not map
+_BITECS_NODISCARD
+bitecs_registry* bitecs_registry_new_mapped(const char* path, size_t capacity);
+// Registry, as it was deleted: components stay defined, handles stay valid. Chunks are not read
+// until touched. NULL: no file, it was not closed cleanly or was written by different build/platform
+_BITECS_NODISCARD
+bitecs_registry* bitecs_registry_open_mapped(const char* path);
+
+typedef enum {
+    // first hole, big enough for created entts
+    bitecs_placement_first_fit = 0,
+    // hole next to entts with same dict + mask (keeps query runs long), else first fit
+    bitecs_placement_archetype,
+} bitecs_Placement;
+
+// where bitecs_entt_create() puts new entts
+void bitecs_registry_set_placement(bitecs_registry* reg, bitecs_Placement placement);
+
 // for loading stuff in background:
 // 1) create clone with same registered components from main
 // 2) do stuff with it (create entts + components on them)
 // 3) merge it into main one
+// schema of reg is shared with out. false if out already uses components of its own
 _BITECS_NODISCARD
 bool bitecs_registry_clone_settings(bitecs_registry* reg, bitecs_registry* out);
 
@@ -100,6 +161,27 @@ bool bitecs_registry_clone_settings(bitecs_registry* reg, bitecs_registry* out);
 _BITECS_NODISCARD
 bool bitecs_registry_merge_other(bitecs_registry* reg, bitecs_registry* from);
 
+// Move entts with all their components (relocater or memcpy) from src into dst (same components
+// must be defined there). ptrs may be stale (skipped). out[i] (optional): handle in dst, {0, ~0} if skipped.
+// returns N moved
+size_t bitecs_entt_transfer(
+    bitecs_registry* src, bitecs_registry* dst, const bitecs_EntityPtr* ptrs, size_t nptrs, bitecs_EntityPtr* out);
+
+// Spawn count entts with exactly the components of prefab (flags are not copied), each a copy of
+// prefab's one (copier or memcpy, filled span by span). out (optional): count handles.
+// false: stale prefab, some component is not copyable (no copier, but deleter/relocater) or OOM
+_BITECS_NODISCARD
+bool bitecs_entt_instantiate(
+    bitecs_registry* reg, bitecs_EntityPtr prefab, bitecs_index_t count, bitecs_EntityPtr* out);
+
+// Copy-on-write fork (rollback, speculative simulation). Chunks and entity table are shared,
+// until one side modifies them: component writes (systems, bitecs_entt_get_component(), batch get/scatter)
+// copy one chunk, structural changes also copy entity table. Both sides may then be used (and deleted)
+// independently, from different threads. Entts, passed into systems, must not be modified directly.
+// NULL on OOM, for mapped registry, or if some component has deleter, but no copier
+_BITECS_NODISCARD
+bitecs_registry* bitecs_registry_fork(bitecs_registry* reg);
+
 typedef enum {
     bitecs_freq1 = 1,
     bitecs_freq2,
@@ -112,6 +194,19 @@ typedef enum {
     bitecs_freq9,
 } bitecs_Frequency;
 
+typedef enum {
+    // chunks, addressed by entt index. Chunk size depends on frequency
+    bitecs_storage_chunked = 0,
+    // paged sparse set. For components, present on tiny part of entts (frequency is ignored)
+    bitecs_storage_sparse,
+    // chunked, two buffers per chunk: systems, that only read component, see values as of last
+    // bitecs_component_swap(), writers modify own copy of chunk (made on first write). So readers and
+    // writer run in parallel (bitecs_system_run_many()) and results do not depend on their order.
+    // bitecs_entt_get_component() and batch get/scatter are writes too (bitecs_entt_read_component() is not).
+    // Trivially copyable types only (no deleter/relocater/copier), no auto_frequency, no bitecs_registry_fork()
+    bitecs_storage_double_buffered,
+} bitecs_Storage;
+
 typedef struct {
     // sizeof(T) of a single component
     size_t typesize;
@@ -119,11 +214,95 @@ typedef struct {
     bitecs_Frequency frequency;
     void (*deleter)(void* begin, bitecs_index_t count);
     void (*relocater)(void* begin, bitecs_index_t count, void* out);
+    // let bitecs_cleanup() retune frequency from observed occupancy.
+    // @warning: bitecs_cleanup() may then rechunk component: pointers to it are invalidated
+    bool auto_frequency;
+    bitecs_Storage storage;
+    // copy construct [begin; begin + count) into out. NULL: memcpy
+    void (*copier)(const void* begin, bitecs_index_t count, void* out);
 } bitecs_ComponentMeta;
 
+// copy-on-write: if schema of reg is shared, reg gets own copy of it first
 _BITECS_NODISCARD
 bool bitecs_component_define(bitecs_registry* reg, bitecs_comp_id_t id, bitecs_ComponentMeta meta);
 
+// Immutable (once shared) set of component metas. Many lightweight registries (per room/match/level chunk)
+// may be created from one schema: creation is O(1), storage of component is allocated on its first use.
+// Refcounted, registries retain it. Not tied to allocator of any registry
+typedef struct bitecs_schema bitecs_schema;
+
+_BITECS_NODISCARD
+bitecs_schema* bitecs_schema_new(void);
+// false: already defined, OOM or schema is already shared (retained or used by some registry)
+_BITECS_NODISCARD
+bool bitecs_schema_define(bitecs_schema* schema, bitecs_comp_id_t id, bitecs_ComponentMeta meta);
+bitecs_schema* bitecs_schema_retain(bitecs_schema* schema);
+void bitecs_schema_release(bitecs_schema* schema);
+
+// schema is retained (caller may release own reference right after). NULL schema: empty
+_BITECS_NODISCARD
+bitecs_registry* bitecs_registry_new_schema(bitecs_schema* schema, const bitecs_Allocator* alloc);
+// current schema of reg (not retained). NULL if nothing was defined yet
+bitecs_schema* bitecs_registry_schema(bitecs_registry* reg);
+
+typedef struct {
+    bitecs_comp_id_t id;
+    bitecs_Frequency frequency;
+    // components alive right now
+    size_t nalives;
+    // chunks allocated right now + how many components they can hold
+    size_t nchunks;
+    size_t capacity;
+    // chunks without alive components (freed by bitecs_cleanup())
+    size_t empty_chunks;
+    // all memory, owned by this component type
+    size_t bytes;
+    // all time counters
+    size_t chunk_allocs;
+    size_t chunk_frees;
+} bitecs_ComponentStats;
+
+_BITECS_NODISCARD
+bool bitecs_component_stats(bitecs_registry* reg, bitecs_comp_id_t id, bitecs_ComponentStats* out);
+
+// frequency, which would bring chunks occupancy closer to ideal
+bitecs_Frequency bitecs_component_suggest_frequency(bitecs_registry* reg, bitecs_comp_id_t id);
+
+// Move all components into chunks of another size.
+// @warning: invalidates all pointers to components of this type
+_BITECS_NODISCARD
+bool bitecs_component_rechunk(bitecs_registry* reg, bitecs_comp_id_t id, bitecs_Frequency freq);
+
+typedef struct {
+    bitecs_dict_t dict;
+    bitecs_mask_t components;
+    bitecs_index_t count;
+} bitecs_ArchetypeStats;
+
+typedef struct {
+    bitecs_index_t entities_live;
+    bitecs_index_t entities_dead;
+    bitecs_index_t entities_cap;
+    // holes in entity table
+    size_t free_nodes;
+    bitecs_index_t free_largest;
+    bitecs_index_t free_total;
+    // empty chunks of all components
+    size_t pending_cleanup_chunks;
+    size_t bytes_total;
+    // defined components, sorted by id
+    bitecs_ComponentStats* components;
+    size_t ncomponents;
+    // distinct dict + mask pairs of alive entts, most common first
+    bitecs_ArchetypeStats* archetypes;
+    size_t narchetypes;
+} bitecs_RegistryStats;
+
+// O(entities + chunks). Free result with bitecs_registry_stats_free()
+_BITECS_NODISCARD
+bool bitecs_registry_stats(bitecs_registry* reg, bitecs_RegistryStats* out);
+void bitecs_registry_stats_free(bitecs_RegistryStats* stats);
+
 typedef struct {
     bitecs_index_t index;
     bitecs_EntityProxy* entts;
@@ -149,7 +328,12 @@ bool bitecs_entt_create(
     bitecs_Callback creator, void* udata);
 
 void bitecs_entt_destroy(bitecs_registry* reg, bitecs_EntityPtr ptr);
+// ptrs may be unordered. Stale and duplicate ptrs are skipped
 void bitecs_entt_destroy_batch(bitecs_registry* reg, const bitecs_EntityPtr* ptrs, size_t nptrs);
+// destroy all entts with components (may be empty) + flags. Same matching as bitecs_system_run()
+// returns N destroyed
+bitecs_index_t bitecs_entt_destroy_matching(
+    bitecs_registry* reg, const bitecs_ComponentsList* components, bitecs_flags_t flags);
 
 // returns void* to be used for initialization. or null if already exists/error
 _BITECS_NODISCARD
@@ -158,6 +342,25 @@ _BITECS_NODISCARD
 bool bitecs_entt_remove_component(bitecs_registry* reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id);
 _BITECS_NODISCARD
 void* bitecs_entt_get_component(bitecs_registry* reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id);
+// same, read only. Double-buffered: previous value (safe to read neighbours from systems, writing the component)
+_BITECS_NODISCARD
+const void* bitecs_entt_read_component(bitecs_registry* reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id);
+// double-buffered: written chunks become previous ones (pointer swap per chunk, no copies).
+// Call between frames, when no systems run. Entts, that get component meanwhile, have no previous value:
+// their initial one is copied into both buffers
+void bitecs_component_swap(bitecs_registry* reg, bitecs_comp_id_t id);
+
+// Batched access by handles. Handles are resolved in order of entt index (with prefetching),
+// results are in order of ptrs. Stale ptrs and entts without component are skipped. Return N found
+// out[i] = component or NULL
+bitecs_index_t bitecs_components_get_batch(
+    bitecs_registry* reg, bitecs_comp_id_t id, const bitecs_EntityPtr* ptrs, size_t nptrs, void** out);
+// raw copy of component into out + i * typesize (skipped slots are untouched)
+bitecs_index_t bitecs_components_gather(
+    bitecs_registry* reg, bitecs_comp_id_t id, const bitecs_EntityPtr* ptrs, size_t nptrs, void* out);
+// raw copy from in + i * typesize into component
+bitecs_index_t bitecs_components_scatter(
+    bitecs_registry* reg, bitecs_comp_id_t id, const bitecs_EntityPtr* ptrs, size_t nptrs, const void* in);
 
 // @warning: do not store this pointer. May be relocated at any time.
 _BITECS_NODISCARD bitecs_EntityProxy* bitecs_entt_deref(bitecs_registry* reg, bitecs_EntityPtr ptr);
@@ -167,18 +370,129 @@ typedef struct {
     const bitecs_ComponentsList* comps;
     bitecs_Callback system;
     void* udata;
+    // optional. used in traces
+    const char* name;
+    // optional: components, that system modifies (subset of comps). NULL: all of comps.
+    // bitecs_system_run_many() runs systems in parallel, unless one writes what other accesses
+    const bitecs_ComponentsList* writes;
 } bitecs_SystemParams;
 
 typedef struct bitecs_threadpool bitecs_threadpool;
 
+typedef void (*bitecs_Task)(void* udata, size_t task);
+
+// nthreads workers + calling thread. 0 (or no pthreads): everything runs on calling thread
+_BITECS_NODISCARD
+bitecs_threadpool* bitecs_threadpool_new(size_t nthreads);
+void bitecs_threadpool_delete(bitecs_threadpool* tpool);
+size_t bitecs_threadpool_size(bitecs_threadpool* tpool);
+// task(udata, i) for i in [0; ntasks) on workers and calling thread. Returns, when all are done.
+// tpool may be NULL (run serially). Not reentrant: do not call from tasks
+void bitecs_threadpool_run(bitecs_threadpool* tpool, bitecs_Task task, void* udata, size_t ntasks);
+// 0 for calling thread, 1+ for threadpool workers
+int bitecs_current_worker(void);
+
 void bitecs_system_run(bitecs_registry* reg, bitecs_SystemParams* params);
 
+// Pull-style iteration: same batches, as system callback would get.
+// Between calls entts may be created, destroyed or have components added/removed (and
+// bitecs_cleanup() run): changes after cursor are seen by next batch. Stop early with bitecs_query_end()
+typedef struct bitecs_query bitecs_query;
+
+typedef struct {
+    // first entt of batch
+    bitecs_index_t index;
+    bitecs_index_t count;
+    bitecs_EntityProxy* entts;
+    // ptrs[i]: count components of comps->components[i]. Valid until next call
+    void** ptrs;
+} bitecs_QueryBatch;
+
+// comps must outlive query. writes: comps modified through batches (NULL - all, see
+// bitecs_SystemParams::writes), others are not copied in forked registry and point to
+// previous buffer for double-buffered components. NULL on OOM
+_BITECS_NODISCARD
+bitecs_query* bitecs_query_begin(
+    bitecs_registry* reg, const bitecs_ComponentsList* comps, bitecs_flags_t flags, const bitecs_ComponentsList* writes);
+// false: no more batches
+_BITECS_NODISCARD
+bool bitecs_query_next(bitecs_query* query, bitecs_QueryBatch* out);
+void bitecs_query_end(bitecs_query* query);
+
+// Resumable (time sliced) system run. Same rules as for bitecs_query: registry may be changed
+// between slices, entts after cursor are matched against their state at next slice
+typedef struct bitecs_run bitecs_run;
+
+// params are copied (comps must outlive run). NULL on OOM
+_BITECS_NODISCARD
+bitecs_run* bitecs_system_run_begin(bitecs_registry* reg, const bitecs_SystemParams* params);
+// Process matches until max_entts are passed to system or max_ns elapsed (checked after each batch).
+// 0 - no limit. Returns true, when all matches are processed
+bool bitecs_system_run_resume(bitecs_run* run, bitecs_index_t max_entts, uint64_t max_ns);
+// start over from first entt
+void bitecs_system_run_restart(bitecs_run* run);
+// all entts below cursor are processed
+bitecs_index_t bitecs_system_run_cursor(bitecs_run* run);
+void bitecs_system_run_end(bitecs_run* run);
+
+// Entity table scan only: chunks are not touched, no callbacks
+bitecs_index_t bitecs_query_count(bitecs_registry* reg, const bitecs_ComponentsList* comps, bitecs_flags_t flags);
+// writes up to cap handles of matching entts (in order of index). Returns N matching (may be > cap)
+bitecs_index_t bitecs_query_collect(
+    bitecs_registry* reg, const bitecs_ComponentsList* comps, bitecs_flags_t flags,
+    bitecs_EntityPtr* out, size_t cap);
+
+// Raw access for header-only query loops (see bitecs::Registry::RunSystem). Not thread safe after
+// bitecs_entt_add_component() of double-buffered component: call once, before systems are started
+// @warning: do not store this pointer. May be relocated at any time. NULL (*count = 0): OOM
+// while copying entity table of forked registry
+bitecs_Entity* bitecs_registry_entities(bitecs_registry* reg, bitecs_index_t* count);
+
+// Resolve storage of components for entts [begin; begin + count). Components are expected to be present.
+// returns N entts, that lie contiguously in all selected chunks (<= count)
+bitecs_index_t bitecs_components_select(
+    bitecs_registry* reg, const int* comps, int ncomps,
+    bitecs_index_t begin, bitecs_index_t count, bitecs_ptrs out);
+// Same, but only comps[i] with bit i set in writes are modified (comps past 64 always are).
+// Matters for forked registries: chunks of written components are copied. 0 - OOM while copying
+bitecs_index_t bitecs_components_select_writes(
+    bitecs_registry* reg, const int* comps, int ncomps, uint64_t writes,
+    bitecs_index_t begin, bitecs_index_t count, bitecs_ptrs out);
+
 typedef struct {
     bitecs_SystemParams* params;
     size_t nsystems;
 } bitecs_MultiSystemParams;
 
-void bitecs_system_run_many(bitecs_registry* registry, bitecs_threadpool* tpool, bitecs_MultiSystemParams* systems);
+// Systems are split into levels: system goes one level after last earlier system, it conflicts with
+// (see bitecs_SystemParams::writes). Systems of one level run in parallel, levels are separated by barrier.
+// Registry must not be modified by systems. false on OOM (nothing was run)
+_BITECS_NODISCARD
+bool bitecs_system_run_many(bitecs_registry* registry, bitecs_threadpool* tpool, bitecs_MultiSystemParams* systems);
+
+// Profiling. Systems are recorded only when built with BITECS_PROFILE defined
+typedef struct {
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    // entts checked by query
+    bitecs_index_t scanned;
+    bitecs_index_t matched;
+    // system callback invocations (avg batch = matched / runs)
+    bitecs_index_t runs;
+    // 0 for calling thread, 1+ for threadpool workers
+    int worker;
+} bitecs_SystemTrace;
+
+uint64_t bitecs_profile_now(void);
+// keep last N traces. 0 disables recording
+_BITECS_NODISCARD bool bitecs_profile_enable(bitecs_registry* reg, size_t capacity);
+void bitecs_profile_record(bitecs_registry* reg, const bitecs_SystemTrace* trace);
+// copy up to max last traces (oldest first). returns N copied
+size_t bitecs_profile_read(bitecs_registry* reg, bitecs_SystemTrace* out, size_t max);
+void bitecs_profile_clear(bitecs_registry* reg);
+// chrome://tracing (or Perfetto) JSON. One lane per worker
+_BITECS_NODISCARD bool bitecs_profile_export_chrome(bitecs_registry* reg, const char* path);
 
 _BITECS_NODISCARD bool bitecs_mask_from_array(bitecs_SparseMask *maskOut, const int *idxs, unsigned idxs_count);
 _BITECS_NODISCARD bool bitecs_mask_set(bitecs_SparseMask* mask, int index, bool state);
@@ -189,16 +503,60 @@ typedef int bitecs_BitsStorage[128];
 _BITECS_NODISCARD
 unsigned bitecs_mask_into_array(const bitecs_SparseMask* mask, const bitecs_Ranks* ranks, int* storage);
 
+// relocate query bits (qdict + qmask, ranks of qdict) into layout of entt dict. edict must contain qdict
+bitecs_mask_t bitecs_mask_adjust(bitecs_dict_t qdict, bitecs_mask_t qmask, const bitecs_Ranks* ranks, bitecs_dict_t edict);
+// "shift" or "pdep" (BITECS_MASK_PDEP build)
+const char* bitecs_mask_impl(void);
+
 
 typedef struct bitecs_cleanup_data bitecs_cleanup_data;
 
-// Deferred cleanup API:
+// Deferred cleanup API: registry may change in between (chunks, which got components or were moved by
+// bitecs_component_rechunk(), are kept). bitecs_cleanup() rechunks auto_frequency components
 _BITECS_NODISCARD bitecs_cleanup_data* bitecs_cleanup_prepare(bitecs_registry* reg);
 void bitecs_cleanup(bitecs_registry* reg, bitecs_cleanup_data* data);
 
+// Sharded world: N registries (shards) with same components. New entts go to shard, chosen by
+// partition key (e.g. spatial cell). Systems are fanned out: one task per shard, shards run in parallel,
+// so each shard has its own entity table, index space and cleanup. World does not own shards.
+// Create shards from one schema (bitecs_registry_new_schema()), so components are defined once for all
+typedef struct bitecs_world bitecs_world;
 
-bitecs_threadpool* bitecs_threadpool_new(size_t nthreads);
-void bitecs_threadpool_delete(bitecs_threadpool* tpool);
+typedef struct {
+    bitecs_EntityPtr ptr;
+    uint32_t shard;
+} bitecs_ShardPtr;
+
+// key -> shard in [0; nshards)
+typedef size_t (*bitecs_Partition)(void* udata, uint64_t key, size_t nshards);
+
+// shards must outlive world. NULL on OOM
+_BITECS_NODISCARD
+bitecs_world* bitecs_world_new(bitecs_registry* const* shards, size_t nshards);
+void bitecs_world_delete(bitecs_world* world);
+size_t bitecs_world_shards_count(bitecs_world* world);
+bitecs_registry* bitecs_world_shard(bitecs_world* world, size_t shard);
+// default: key % nshards
+void bitecs_world_set_partition(bitecs_world* world, bitecs_Partition partition, void* udata);
+size_t bitecs_world_route(bitecs_world* world, uint64_t key);
+// bitecs_entt_create() in shard of key. *outShard (optional) gets that shard
+_BITECS_NODISCARD
+bool bitecs_world_entt_create(
+    bitecs_world* world, uint64_t key, bitecs_index_t count,
+    const bitecs_ComponentsList* components, bitecs_Callback creator, void* udata, uint32_t* outShard);
+// task(udata, shard) for every shard on tpool (may be NULL). Same rules as for bitecs_threadpool_run()
+void bitecs_world_run(bitecs_world* world, bitecs_threadpool* tpool, bitecs_Task task, void* udata);
+// system runs concurrently on all shards (callback must be thread safe)
+void bitecs_world_system_run(bitecs_world* world, bitecs_threadpool* tpool, bitecs_SystemParams* params);
+// bitecs_system_run_many() per shard (serially inside of shard, shards in parallel)
+_BITECS_NODISCARD
+bool bitecs_world_system_run_many(bitecs_world* world, bitecs_threadpool* tpool, bitecs_MultiSystemParams* systems);
+// sum of bitecs_query_count() over shards
+uint64_t bitecs_world_query_count(bitecs_world* world, const bitecs_ComponentsList* comps, bitecs_flags_t flags);
+// bitecs_cleanup_prepare() + bitecs_cleanup() of all shards in parallel
+void bitecs_world_cleanup(bitecs_world* world, bitecs_threadpool* tpool);
+// shard of current world task (or entt creation). -1 outside of them
+int bitecs_current_shard(void);
 
 
 #ifdef __cplusplus
@@ -5,8 +5,14 @@
 
 #include "bitecs_core.h"
 #include <array>
+#include <cstdint>
 #include <exception>
+#include <type_traits>
 #include <utility>
+#ifdef BITECS_PROFILE
+#include <string>
+#include <string_view>
+#endif
 
 namespace bitecs
 {
@@ -20,6 +26,7 @@ using comp_id_t = bitecs_comp_id_t;
 using Entity = bitecs_Entity;
 using EntityProxy = bitecs_EntityProxy;
 using EntityPtr = bitecs_EntityPtr;
+using ShardPtr = bitecs_ShardPtr;
 using CallbackContext = bitecs_CallbackContext;
 
 template<typename...T>
@@ -89,6 +96,112 @@ constexpr std::array<int, sizeof...(Comps)> sorted_ids()
     return res;
 }
 
+constexpr dict_t dead_entt = ~dict_t(0);
+
+constexpr dict_t fill_up_to(int bit) {
+    return (dict_t(1) << bit) - dict_t(1);
+}
+
+// constexpr mirror of bitecs_mask_from_array()
+template<size_t N>
+constexpr bitecs_SparseMask mask_from_sorted(const std::array<int, N>& idxs) {
+    bitecs_SparseMask res = {};
+    for (int idx: idxs) {
+        int group = idx >> BITECS_GROUP_SHIFT;
+        res.dict |= dict_t(1) << group;
+        int groupIndex = __builtin_popcountll(res.dict) - 1;
+        int bit = idx & fill_up_to(BITECS_GROUP_SHIFT);
+        res.bits |= mask_t(1) << (groupIndex * BITECS_GROUP_SIZE + bit);
+    }
+    return res;
+}
+
+// constexpr mirror of bitecs_ranks_get()
+constexpr bitecs_Ranks ranks_get(dict_t dict) {
+    bitecs_Ranks res = {};
+    int rank = 0;
+    while (dict) {
+        int trailing = __builtin_ctzll(dict);
+        rank += trailing;
+        int i = res.groups_count++;
+        res.group_ranks[i] = rank;
+        res.select_dict_masks[i] = fill_up_to(rank);
+        dict >>= trailing + 1;
+        rank++;
+    }
+    if (res.groups_count) {
+        res.highest_select_mask = res.select_dict_masks[res.groups_count - 1];
+    }
+    return res;
+}
+
+// Everything bitecs_query_match() computes at runtime, known at compile time
+template<typename...Comps>
+struct static_query
+{
+    static constexpr auto sorted = sorted_ids<Comps...>();
+    static constexpr bitecs_SparseMask mask = mask_from_sorted(sorted);
+    static constexpr bitecs_Ranks ranks = ranks_get(mask.dict);
+
+    // query bits of each group. When entt has extra groups below one of them -> it is shifted up
+    static constexpr std::array<mask_t, BITECS_GROUPS_COUNT> parts = []{
+        std::array<mask_t, BITECS_GROUPS_COUNT> res = {};
+        for (int i = 0; i < BITECS_GROUPS_COUNT; ++i) {
+            mask_t group = mask_t(fill_up_to(BITECS_GROUP_SIZE)) << (i * BITECS_GROUP_SIZE);
+            res[i] = mask.bits & group;
+        }
+        return res;
+    }();
+
+    _BITECS_INLINE static mask_t adjusted(dict_t diff) {
+        if (!(diff & ranks.highest_select_mask)) {
+            return mask.bits;
+        }
+        mask_t res = 0;
+        for (int i = 0; i < ranks.groups_count; ++i) {
+            int shift = __builtin_popcountll(diff & ranks.select_dict_masks[i]) * BITECS_GROUP_SIZE;
+            res |= parts[i] << shift;
+        }
+        return res;
+    }
+};
+
+// Caches adjusted mask for last seen entt dict (runs of same archetype are common)
+template<typename Query>
+struct static_matcher
+{
+    flags_t flags;
+    dict_t dict = dead_entt;
+    mask_t mask = 0;
+
+    _BITECS_INLINE bool operator()(const Entity& entt) {
+        if (entt.dict == dead_entt) return false;
+        if ((entt.flags & flags) != flags) return false;
+        if (entt.dict != dict) {
+            if ((entt.dict & Query::mask.dict) != Query::mask.dict) return false;
+            dict = entt.dict;
+            mask = Query::adjusted(entt.dict ^ Query::mask.dict);
+        }
+        return (entt.components & mask) == mask;
+    }
+};
+
+template<typename Query>
+_BITECS_INLINE inline index_t query_match(static_matcher<Query>& match, index_t cursor, const Entity* entts, index_t count) {
+    for (; cursor < count; ++cursor) {
+        if (match(entts[cursor])) break;
+    }
+    return cursor;
+}
+
+template<typename Query>
+_BITECS_INLINE inline index_t query_miss(static_matcher<Query>& match, index_t cursor, const Entity* entts, index_t count) {
+    for (; cursor < count; ++cursor) {
+        if (!match(entts[cursor])) break;
+    }
+    return cursor;
+}
+
 template<typename T>
 _BITECS_FLATTEN void deleter_for(void* begin, index_t count) {
     for (index_t i = 0; i < count; ++i) {
@@ -106,6 +219,13 @@ _BITECS_FLATTEN void relocater_for(void* begin, index_t count, void* out) {
     }
 }
 
+template<typename T>
+_BITECS_FLATTEN void copier_for(const void* begin, index_t count, void* out) {
+    for (index_t i = 0; i < count; ++i) {
+        new (static_cast<T*>(out) + i) T{static_cast<const T*>(begin)[i]};
+    }
+}
+
 
 template<typename T>
 _BITECS_INLINE inline static T* select(void* batch, index_t i) {
@@ -160,6 +280,22 @@ struct multi_creator<Fn, std::index_sequence<Is...>, Comps...> {
     }
 };
 
+#ifdef BITECS_PROFILE
+// "Fn" from pretty function name (gcc: "[with Fn = X]", clang: "[Fn = X]")
+template<typename Fn>
+const char* system_name() {
+    static const std::string name = [pretty = std::string_view(__PRETTY_FUNCTION__)]{
+        constexpr std::string_view marker = "Fn = ";
+        auto begin = pretty.find(marker);
+        if (begin == std::string_view::npos) return std::string(pretty);
+        begin += marker.size();
+        auto end = pretty.find_first_of(";]", begin);
+        return std::string(pretty.substr(begin, end - begin));
+    }();
+    return name.c_str();
+}
+#endif
+
 template<typename T>
 auto remove_cvref(Tag<T>) -> T;
 
@@ -189,5 +325,75 @@ auto deduce_args(Fn) -> decltype(impl::deduce_args(&Fn::operator()));
 template<typename Fn>
 using deduce_args_t = decltype(impl::deduce_args(std::declval<Fn>()));
 
+// Same, but qualifiers are kept: const T& (or T) - read, T& - write
+template<typename Ret, typename...Args>
+auto deduce_access(Ret(*)(Args...)) -> TypeList<Args...>;
+
+template<typename Ret, typename C, typename...Args>
+auto deduce_access(Ret(C::*)(Args...)) -> TypeList<Args...>;
+
+template<typename Ret, typename C, typename...Args>
+auto deduce_access(Ret(C::*)(Args...) const) -> TypeList<Args...>;
+
+template<typename Fn, typename = decltype(&Fn::operator())>
+auto deduce_access(Fn) -> decltype(impl::deduce_access(&Fn::operator()));
+
+auto deduce_access(...) -> void;
+
+template<typename Fn>
+using deduce_access_t = decltype(impl::deduce_access(std::declval<Fn>()));
+
+template<typename Arg>
+constexpr bool is_write_v = std::is_lvalue_reference_v<Arg> && !std::is_const_v<std::remove_reference_t<Arg>>;
+
+struct AccessSet
+{
+    static constexpr int words = BITECS_MAX_COMPONENTS / 64;
+    uint64_t reads[words] = {};
+    uint64_t writes[words] = {};
+
+    constexpr void Add(int id, bool write) {
+        (write ? writes : reads)[id / 64] |= uint64_t(1) << (id % 64);
+    }
+
+    // write of one overlaps with any access of other
+    constexpr bool ConflictsWith(const AccessSet& other) const {
+        for (int i = 0; i < words; ++i) {
+            if (writes[i] & (other.reads[i] | other.writes[i])) return true;
+            if (other.writes[i] & reads[i]) return true;
+        }
+        return false;
+    }
+};
+
+template<typename...Args>
+constexpr AccessSet access_set(TypeList<Args...>) {
+    AccessSet res;
+    (res.Add(component_id<decltype(impl::remove_cvref(Tag<Args>{}))>, is_write_v<Args>), ...);
+    return res;
+}
+
+template<typename Fn>
+constexpr AccessSet access_of = access_set(deduce_access_t<Fn>{});
+
+template<typename Comp, typename...Args>
+constexpr bool writes_comp(TypeList<Args...>) {
+    return ((std::is_same_v<decltype(impl::remove_cvref(Tag<Args>{})), Comp> && is_write_v<Args>) || ...);
+}
+
+// bit i: Comps[i] is modified by Fn (see bitecs_components_select_writes()). Unknown signature: all are
+template<typename Fn, typename...Comps>
+constexpr uint64_t writes_mask() {
+    using access = deduce_access_t<Fn>;
+    if constexpr (std::is_void_v<access>) {
+        return ~uint64_t(0);
+    } else {
+        uint64_t res = 0;
+        int i = 0;
+        ((res |= uint64_t(i < 64 && writes_comp<Comps>(access{})) << (i % 64), ++i), ...);
+        return sizeof...(Comps) > 64 ? ~uint64_t(0) : res;
+    }
+}
+
 
 } //bitecs::impl
@@ -1,20 +1,46 @@
 // MIT License. See LICENSE file for details
 // Copyright (c) 2025 Доронин Алексей
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // fallocate()
+#endif
 #include "bitecs/bitecs_core.h"
 #include <assert.h>
 #include <limits.h>
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BITECS_HAS_MMAP 1
+#define BITECS_HAS_PTHREAD 1
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef BITECS_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
 
 #define likely(x)       __builtin_expect(!!(x), 1)
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 #define popcnt32(x) __builtin_popcount(x)
-#define dict_popcnt(x) __builtin_popcountl(x)
+#define dict_popcnt(x) __builtin_popcountll(x)
+#define dict_ctz(x) __builtin_ctzll(x)
 #define clz(x) __builtin_clz(x)
 #define ctz(x) __builtin_ctz(x)
 
+#if defined(BITECS_MASK_PDEP) && defined(__BMI2__)
+#include <immintrin.h>
+#define MASK_PDEP 1
+#endif
+
 typedef bitecs_mask_t mask_t;
 typedef bitecs_index_t index_t;
 typedef bitecs_dict_t dict_t;
@@ -33,371 +59,2312 @@ typedef struct
 {
     struct _chunk_header {
         index_t nalives;
+        // registries, that hold this chunk (> 1 after bitecs_registry_fork())
+        _Atomic(index_t) refs;
     } header;
     char _pad[sizeof(Entity) - sizeof(struct _chunk_header)];
     char storage[];
 } Chunk;
 
-typedef struct component_list
+#define SPARSE_PAGE_SHIFT 10
+#define SPARSE_PAGE_SIZE ((size_t)1 << SPARSE_PAGE_SHIFT)
+
+static const index_t sparse_none = ~(index_t)0;
+
+// file-backed storage for chunks and entity table (bitecs_registry_new_mapped()).
+// Everything in file is addressed by offset, page 0 holds MappedHeader (see registry_persist())
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} ArenaRange;
+
+// small allocations (not page multiples): slots of one size, carved out of slabs.
+// Free slots are chained through their first bytes (offset of next, 0: none)
+typedef struct {
+    uint64_t size;
+    uint64_t free;
+    // rest of current slab
+    uint64_t top;
+    uint64_t end;
+} ArenaBin;
+
+#define ARENA_BINS 16
+// CHUNK_ALIGN
+#define ARENA_SLOT_ALIGN 64
+// slots up to that many pages are carved from slabs of ARENA_SLAB_SLOTS (bigger allocations take whole pages)
+#define ARENA_SLOT_MAX_PAGES 4
+#define ARENA_SLAB_SLOTS 16
+#define ARENA_MAGIC 0x3130534345544942ull // "BITECS01"
+
+typedef struct MappedArena
 {
-    Chunk** chunks;
-    size_t nchunks;
-    bitecs_ComponentMeta meta;
-} component_list;
+    int fd;
+    char* base;
+    size_t capacity;
+    size_t page;
+    // everything above top is untouched
+    size_t top;
+    // freed ranges below top: sorted by offset, coalesced
+    ArenaRange* holes;
+    size_t nholes;
+    size_t holes_cap;
+    ArenaBin bins[ARENA_BINS];
+} MappedArena;
 
-static int components_shift(component_list* list) {
-    return list->meta.frequency + BITECS_FREQUENCY_ADJUST;
+typedef struct {
+    uint64_t id;
+    uint64_t typesize;
+    uint64_t frequency;
+    uint64_t auto_frequency;
+    uint64_t nchunks;
+    // uint64_t[nchunks]: offsets of chunks (0: none)
+    uint64_t chunks;
+} MappedComponent;
+
+// written on bitecs_registry_delete(), magic is cleared, while file is open
+typedef struct {
+    uint64_t magic;
+    uint64_t page;
+    uint64_t entity_size;
+    // arena
+    uint64_t top;
+    // ArenaRange[holes_reserved], nholes of them are used
+    uint64_t holes;
+    uint64_t nholes;
+    uint64_t holes_reserved;
+    ArenaBin bins[ARENA_BINS];
+    // registry
+    uint64_t entities;
+    uint64_t entities_count;
+    uint64_t entities_cap;
+    uint64_t generation;
+    uint64_t placement;
+    // IndexRange[nfree]
+    uint64_t free;
+    uint64_t nfree;
+    // MappedComponent[ncomponents]
+    uint64_t components;
+    uint64_t ncomponents;
+} MappedHeader;
+
+_Static_assert(sizeof(MappedHeader) <= 4096, "header must fit into page 0");
+
+#ifdef BITECS_HAS_MMAP
+
+static size_t arena_round(MappedArena* arena, size_t size) {
+    return (size + arena->page - 1) & ~(arena->page - 1);
 }
 
-static size_t components_in_chunk(component_list* list) {
-    return (size_t)1 << components_shift(list);
+// back range with disk blocks now: ENOSPC is reported here instead of SIGBUS on first touch
+static bool arena_commit(MappedArena* arena, size_t offset, size_t size) {
+#ifdef __linux__
+    return fallocate(arena->fd, 0, (off_t)offset, (off_t)size) == 0;
+#else
+    (void)arena; (void)offset; (void)size;
+    return true;
+#endif
 }
 
-static size_t chunk_sizeof(component_list* list) {
-    return components_in_chunk(list) * list->meta.typesize + sizeof(Chunk);
+// give pages back to filesystem (and page cache). Range reads as zeroes after that
+static void arena_punch(MappedArena* arena, size_t offset, size_t size) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(arena->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)size) == 0) return;
+#endif
+#ifdef MADV_REMOVE
+    if (madvise(arena->base + offset, size, MADV_REMOVE) == 0) return;
+#endif
+    // not supported by filesystem: range just gets reused by next allocations
 }
 
-static component_list* components_new(bitecs_ComponentMeta meta) {
-    component_list* res = malloc(sizeof(component_list));
-    if (!res) return res;
-    *res = (component_list){0};
-    res->meta = meta;
-    return res;
+static void* arena_pages_alloc(MappedArena* arena, size_t size) {
+    for (size_t i = 0; i < arena->nholes; ++i) {
+        ArenaRange* hole = arena->holes + i;
+        if (hole->size < size) continue;
+        size_t offset = hole->offset;
+        if (unlikely(!arena_commit(arena, offset, size))) return NULL;
+        hole->offset += size;
+        hole->size -= size;
+        if (!hole->size) {
+            memmove(hole, hole + 1, sizeof(ArenaRange) * (arena->nholes - i - 1));
+            arena->nholes--;
+        }
+        return arena->base + offset;
+    }
+    if (arena->capacity - arena->top < size) return NULL;
+    size_t offset = arena->top;
+    if (unlikely(!arena_commit(arena, offset, size))) return NULL;
+    arena->top += size;
+    return arena->base + offset;
 }
 
-static void components_destroy_trivial(component_list* list)
-{
-    if (!list) return;
-    for (size_t i = 0; i < list->nchunks; ++i) {
-        Chunk* chunk = list->chunks[i];
-        if (chunk) {
-            free(chunk);
+static void arena_pages_free(MappedArena* arena, void* ptr, size_t size) {
+    size_t offset = (size_t)((char*)ptr - arena->base);
+    arena_punch(arena, offset, size);
+    if (offset + size == arena->top) {
+        arena->top = offset;
+        while (arena->nholes) {
+            ArenaRange* last = arena->holes + arena->nholes - 1;
+            if (last->offset + last->size != arena->top) break;
+            arena->top = last->offset;
+            arena->nholes--;
         }
+        return;
     }
-    if (list->chunks) {
-        free(list->chunks);
+    size_t i = 0;
+    while (i < arena->nholes && arena->holes[i].offset < offset) i++;
+    ArenaRange* prev = i ? arena->holes + i - 1 : NULL;
+    ArenaRange* next = i < arena->nholes ? arena->holes + i : NULL;
+    bool mergePrev = prev && prev->offset + prev->size == offset;
+    bool mergeNext = next && offset + size == next->offset;
+    if (mergePrev && mergeNext) {
+        prev->size += size + next->size;
+        memmove(next, next + 1, sizeof(ArenaRange) * (arena->nholes - i - 1));
+        arena->nholes--;
+    } else if (mergePrev) {
+        prev->size += size;
+    } else if (mergeNext) {
+        next->offset = offset;
+        next->size += size;
+    } else {
+        if (arena->nholes == arena->holes_cap) {
+            size_t newCap = arena->holes_cap ? arena->holes_cap * 2 : 16;
+            ArenaRange* grown = realloc(arena->holes, sizeof(ArenaRange) * newCap);
+            if (unlikely(!grown)) return; // range is lost (but already punched out)
+            arena->holes = grown;
+            arena->holes_cap = newCap;
+        }
+        memmove(arena->holes + i + 1, arena->holes + i, sizeof(ArenaRange) * (arena->nholes - i));
+        arena->holes[i] = (ArenaRange){offset, size};
+        arena->nholes++;
     }
-    free(list);
 }
 
-static void components_destroy(bitecs_registry* reg, component_list* list)
-{
-    assert(false && "todo");
+// bins are never given back: same size always goes same way (bin or pages)
+static ArenaBin* arena_bin(MappedArena* arena, size_t size, bool create) {
+    size = (size + ARENA_SLOT_ALIGN - 1) & ~(size_t)(ARENA_SLOT_ALIGN - 1);
+    if (size > arena->page * ARENA_SLOT_MAX_PAGES || size % arena->page == 0) return NULL;
+    ArenaBin* empty = NULL;
+    for (int i = 0; i < ARENA_BINS; ++i) {
+        ArenaBin* bin = arena->bins + i;
+        if (bin->size == size) return bin;
+        if (!empty && !bin->size) empty = bin;
+    }
+    if (!create || !empty) return NULL;
+    empty->size = size;
+    return empty;
 }
 
-typedef struct FreeList
-{
-    index_t index;
-    index_t count;
-    struct FreeList* prev;
-    struct FreeList* next;
-} FreeList;
-
-
-_BITECS_NODISCARD
-static bool take_free(FreeList** _list, index_t count, index_t* outIndex) {
-    FreeList* list = *_list;
-    if (!list) return false;
-    while(list) {
-        if (list->count > count) {
-            *outIndex = list->index;
-            list->count -= count;
-            list->index += count;
-            return true;
-        } else if (list->count == count) {
-            *outIndex = list->index;
-            if (list->prev) list->prev->next = list->next;
-            if (list->next) list->next->prev = list->prev;
-            *_list = list->next;
-            free(list);
-            return true;
-        } else {
-            list = list->next;
-        }
+static void* arena_alloc(MappedArena* arena, size_t size) {
+    ArenaBin* bin = arena_bin(arena, size, true);
+    if (!bin) return arena_pages_alloc(arena, arena_round(arena, size));
+    if (bin->free) {
+        uint64_t offset = bin->free;
+        memcpy(&bin->free, arena->base + offset, sizeof(uint64_t));
+        return arena->base + offset;
     }
-    return false;
+    if (bin->end - bin->top < bin->size) {
+        size_t slab = arena_round(arena, bin->size * ARENA_SLAB_SLOTS);
+        char* pages = arena_pages_alloc(arena, slab);
+        if (unlikely(!pages)) return NULL;
+        bin->top = (uint64_t)(pages - arena->base);
+        bin->end = bin->top + slab;
+    }
+    uint64_t offset = bin->top;
+    bin->top += bin->size;
+    return arena->base + offset;
 }
 
-_BITECS_NODISCARD
-static bool add_free(FreeList** _list, index_t index, index_t count) {
-    FreeList* old = *_list;
-    while(old) {
-        if (old->index + old->count == index) {
-            old->count += count;
-            return true;
-        } else if (index + count == old->index) {
-            old->index -= count;
-            old->count += count;
-            return true;
-        }
-        old = old->next;
-    }
-    old = *_list;
-    FreeList* New = *_list = malloc(sizeof(FreeList));
-    if (!New) return false;
-    New->count = count;
-    New->prev = 0;
-    New->next = old;
-    New->index = index;
-    if (old) {
-        old->prev = New;
+// slots are recycled inside of file, whole pages are punched out
+static void arena_free(MappedArena* arena, void* ptr, size_t size) {
+    ArenaBin* bin = arena_bin(arena, size, false);
+    if (!bin) {
+        arena_pages_free(arena, ptr, arena_round(arena, size));
+        return;
     }
-    return true;
+    memcpy(ptr, &bin->free, sizeof(uint64_t));
+    bin->free = (uint64_t)((char*)ptr - arena->base);
 }
 
-struct bitecs_registry
-{
-    Entity* entities;
-    FreeList* freeList;
-    index_t entities_count;
-    index_t entities_cap;
-    index_t total_free;
-    bitecs_generation_t generation;
-    component_list* components[BITECS_MAX_COMPONENTS];
-    _Atomic(bool) chunks_cleanup_pending;
-};
+static MappedHeader* arena_header(MappedArena* arena) {
+    return (MappedHeader*)arena->base;
+}
 
-bool bitecs_component_define(bitecs_registry* reg, bitecs_comp_id_t id, bitecs_ComponentMeta meta)
-{
-    assert(meta.typesize >= 0);
-    if (reg->components[id]) return false;
-    reg->components[id] = components_new(meta);
-    return (bool)reg->components[id];
+static MappedArena* arena_map(int fd, size_t capacity) {
+    MappedArena* arena = calloc(1, sizeof(MappedArena));
+    if (!arena) return NULL;
+    arena->fd = fd;
+    arena->page = (size_t)sysconf(_SC_PAGESIZE);
+    arena->capacity = capacity;
+    arena->top = arena->page;
+    void* base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        free(arena);
+        return NULL;
+    }
+    arena->base = base;
+    return arena;
 }
 
-bitecs_registry* bitecs_registry_new(void)
-{
-    bitecs_registry* result = malloc(sizeof(bitecs_registry));
-    if (!result) return result;
-    *result = (bitecs_registry){0};
-    return result;
+static void arena_close(MappedArena* arena) {
+    if (!arena) return;
+    munmap(arena->base, arena->capacity);
+    close(arena->fd);
+    free(arena->holes);
+    free(arena);
 }
 
+// existing file is not overwritten
+static MappedArena* arena_open(const char* path, size_t capacity) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    capacity = (capacity + page - 1) & ~(page - 1);
+    if (capacity <= page) return NULL;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    MappedArena* arena = ftruncate(fd, (off_t)capacity) == 0 ? arena_map(fd, capacity) : NULL;
+    if (arena && arena_commit(arena, 0, page)) return arena;
+    if (arena) {
+        arena_close(arena);
+    } else {
+        close(fd);
+    }
+    unlink(path);
+    return NULL;
+}
 
-void bitecs_registry_delete(bitecs_registry* reg)
-{
-    if (!reg) return;
-    if (reg->entities) {
-        free(reg->entities);
+// file, closed by registry_persist(). Arena state is restored, holes block is still in use
+static MappedArena* arena_reopen(const char* path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return NULL;
+    MappedHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+        || header.magic != ARENA_MAGIC || header.page != (uint64_t)sysconf(_SC_PAGESIZE)
+        || header.entity_size != sizeof(Entity) || header.top > (uint64_t)st.st_size
+        || header.holes + sizeof(ArenaRange) * header.nholes > header.top) {
+        close(fd);
+        return NULL;
     }
-    for (int i = 0; i < BITECS_MAX_COMPONENTS; ++i) {
-        component_list* list = reg->components[i];
-        if (!list) continue;
-        if (list->meta.deleter) {
-            components_destroy(reg, list);
-        } else {
-            components_destroy_trivial(list);
-        }
+    MappedArena* arena = arena_map(fd, (size_t)st.st_size);
+    if (!arena) {
+        close(fd);
+        return NULL;
     }
-    FreeList* list = reg->freeList;
-    while (list) {
-        FreeList* next = list->next;
-        free(list);
-        list = next;
+    arena->top = header.top;
+    memcpy(arena->bins, header.bins, sizeof(arena->bins));
+    if (header.nholes) {
+        arena->holes = malloc(sizeof(ArenaRange) * header.nholes);
+        if (unlikely(!arena->holes)) {
+            munmap(arena->base, arena->capacity);
+            close(fd);
+            free(arena);
+            return NULL;
+        }
+        memcpy(arena->holes, arena->base + header.holes, sizeof(ArenaRange) * header.nholes);
+        arena->nholes = arena->holes_cap = header.nholes;
     }
-    *reg = (bitecs_registry){0};
-    free(reg);
+    return arena;
 }
 
-static index_t select_up_to_chunk(component_list* list, index_t begin, index_t count, bitecs_ptrs outBegin)
-{
-    if (unlikely(!list->meta.typesize)) {
-        *outBegin = 0;
-        return count;
+#else
+
+static void* arena_alloc(MappedArena* arena, size_t size) { (void)arena; (void)size; return NULL; }
+static void arena_free(MappedArena* arena, void* ptr, size_t size) { (void)arena; (void)ptr; (void)size; }
+static MappedHeader* arena_header(MappedArena* arena) { (void)arena; return NULL; }
+static MappedArena* arena_open(const char* path, size_t capacity) { (void)path; (void)capacity; return NULL; }
+static MappedArena* arena_reopen(const char* path) { (void)path; return NULL; }
+static void arena_close(MappedArena* arena) { (void)arena; }
+
+#endif
+
+// allocators (bitecs_registry_new_with())
+
+#define MEM_ALIGN _Alignof(max_align_t)
+// chunks never share cache lines (workers write different chunks)
+#define CHUNK_ALIGN 64
+
+static void* default_alloc(void* udata, size_t size, size_t align, bitecs_AllocKind kind) {
+    (void)udata; (void)kind;
+    if (align <= MEM_ALIGN) return malloc(size);
+#ifdef _MSC_VER
+    return _aligned_malloc(size, align);
+#else
+    return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+#endif
+}
+
+static void default_free(void* udata, void* ptr, size_t size, size_t align, bitecs_AllocKind kind) {
+    (void)udata; (void)size; (void)kind;
+#ifdef _MSC_VER
+    if (align > MEM_ALIGN) {
+        _aligned_free(ptr);
+        return;
     }
-    index_t chunk = begin >> components_shift(list);
-    index_t i = begin & fill_up_to(components_shift(list));
-    char* chunkBegin = list->chunks[chunk]->storage;
-    assert(chunkBegin && "Attempt to select from NULL chunk (mask of component lies?)");
-    *outBegin = chunkBegin + i * list->meta.typesize;
-    index_t chunkTail = components_in_chunk(list) - i;
-    return count > chunkTail ? chunkTail : count;
+#else
+    (void)align;
+#endif
+    free(ptr);
 }
 
-typedef struct
-{
-    bitecs_SparseMask query;
-    bitecs_Ranks ranks;
-    bitecs_flags_t flags;
-} QueryCtx;
+static const bitecs_Allocator default_allocator = {default_alloc, default_free, NULL};
 
-typedef struct
+const bitecs_Allocator* bitecs_allocator_default(void)
 {
-    bitecs_ptrs ptrStorage; //should have space for void*[ncomps]
-    const int* components;
-    int ncomps;
-    bitecs_Callback system;
-    void* udata;
-    QueryCtx queryContext;
-    bitecs_index_t cursor;
-    Entity* begin;
-    bitecs_index_t count;
-} StepCtx;
+    return &default_allocator;
+}
 
-static bool bitecs_system_step(bitecs_registry* reg, StepCtx* ctx);
+static void* mem_alloc(const bitecs_Allocator* alloc, size_t size, bitecs_AllocKind kind) {
+    return alloc->alloc(alloc->udata, size, MEM_ALIGN, kind);
+}
 
-static bitecs_index_t bitecs_query_match(
-        bitecs_index_t cursor, const QueryCtx* ctx,
-        const bitecs_Entity* entts, bitecs_index_t count);
+static void mem_free(const bitecs_Allocator* alloc, void* ptr, size_t size, bitecs_AllocKind kind) {
+    if (ptr) alloc->free(alloc->udata, ptr, size, MEM_ALIGN, kind);
+}
 
-static bitecs_index_t bitecs_query_miss(
-        bitecs_index_t cursor, const QueryCtx* ctx,
-        const bitecs_Entity* entts, bitecs_index_t count);
+// mapped registry: chunks + entity table live in file, rest is on heap
+static bool is_mapped_kind(bitecs_AllocKind kind) {
+    return kind == bitecs_alloc_chunk || kind == bitecs_alloc_entities;
+}
 
-static bool bitecs_system_step(bitecs_registry *reg, StepCtx* ctx)
-{
-    index_t offset = bitecs_query_match(ctx->cursor, &ctx->queryContext, ctx->begin, ctx->count);
-    if (unlikely(offset == ctx->count)) return false;
-    index_t end = bitecs_query_miss(offset, &ctx->queryContext, ctx->begin, ctx->count);
-    bitecs_CallbackContext cb_ctx;
-    while (end > offset) {
-        index_t count = end - offset;
-        index_t smallestRange = ~(index_t)0;
-        bitecs_ptrs begins = ctx->ptrStorage;
-        for (int i = 0; i < ctx->ncomps; ++i) {
-            int comp = ctx->components[i];
-            component_list* list = reg->components[comp];
-            index_t selected = select_up_to_chunk(list, offset, count, begins++);
-            smallestRange = selected < smallestRange ? selected : smallestRange;
-        }
-        cb_ctx.index = offset;
-        cb_ctx.entts = (bitecs_EntityProxy*)ctx->begin + offset;
-        ctx->system(ctx->udata, &cb_ctx, ctx->ptrStorage, smallestRange);
-        offset += smallestRange;
+static void* mapped_alloc(void* udata, size_t size, size_t align, bitecs_AllocKind kind) {
+    return is_mapped_kind(kind) ? arena_alloc(udata, size) : default_alloc(NULL, size, align, kind);
+}
+
+static void mapped_free(void* udata, void* ptr, size_t size, size_t align, bitecs_AllocKind kind) {
+    if (is_mapped_kind(kind)) {
+        arena_free(udata, ptr, size);
+    } else {
+        default_free(NULL, ptr, size, align, kind);
     }
-    ctx->cursor = end;
-    return end != reg->entities_count;
 }
 
-void bitecs_system_run(bitecs_registry *reg, bitecs_SystemParams* params)
-{
-    if (unlikely(!params->comps->ncomps)) return;
-    StepCtx ctx = {0};
-    ctx.queryContext.flags = params->flags;
-    ctx.queryContext.query = params->comps->mask;
-    bitecs_ranks_get(&ctx.queryContext.ranks, ctx.queryContext.query.dict);
-    void* ptrs[params->comps->ncomps];
-    ctx.ptrStorage = ptrs;
-    ctx.system = params->system;
-    ctx.udata = params->udata;
-    ctx.components = params->comps->components;
-    ctx.ncomps = params->comps->ncomps;
-    ctx.begin = reg->entities;
-    ctx.count = reg->entities_count;
-    while (bitecs_system_step(reg, &ctx)) {
-        // pass
+#ifdef BITECS_NUMA
+
+// Chunks are carved out of per-node slabs: one mapping per slab instead of per chunk
+// (vm.max_map_count). Freed chunks are kept in bins by size (pages, except first, are given
+// back to OS) and are reused by same pool only. Pools live until process exit
+#define NUMA_SLAB_SIZE ((size_t)32 << 20)
+// larger chunks get their own mapping
+#define NUMA_SLAB_MAX_CHUNK (NUMA_SLAB_SIZE / 4)
+#define NUMA_BINS 16
+// pools[0]: first touch, pools[node + 1]: bound to node
+#define NUMA_MAX_POOLS 65
+
+typedef struct NumaBlock {
+    struct NumaBlock* next;
+} NumaBlock;
+
+typedef struct {
+    size_t size;
+    NumaBlock* head;
+} NumaBin;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int node;
+    char* top;
+    char* end;
+    NumaBin bins[NUMA_BINS];
+} NumaPool;
+
+static NumaPool numa_pools[NUMA_MAX_POOLS];
+static pthread_once_t numa_pools_once = PTHREAD_ONCE_INIT;
+
+static void numa_pools_init(void) {
+    for (int i = 0; i < NUMA_MAX_POOLS; ++i) {
+        pthread_mutex_init(&numa_pools[i].lock, NULL);
+        numa_pools[i].node = i - 1;
     }
 }
 
-static Entity* deref(bitecs_registry* reg, bitecs_EntityPtr ptr)
-{
-    return ptr.index < reg->entities_count && reg->entities[ptr.index].generation == ptr.generation
-        ? reg->entities + ptr.index
-        : NULL;
+static bool numa_mapped(size_t size, bitecs_AllocKind kind) {
+    return kind == bitecs_alloc_chunk && size >= (size_t)numa_pagesize();
 }
 
-static bool reserve_chunks(component_list* list, index_t index, index_t count)
-{
-    if (unlikely(!list->meta.typesize)) return true;
-    index_t maxIndex = index + count;
-    index_t chunk = maxIndex >> components_shift(list);
-    if (list->nchunks <= chunk) {
-        index_t newSize = chunk + 1;
-        Chunk** newChunks = malloc(sizeof(Chunk*) * newSize);
-        if (!newChunks) return false;
-        if (list->chunks) {
-            memcpy(newChunks, list->chunks, sizeof(Chunk*) * list->nchunks);
-            free(list->chunks);
-        }
-        memset(newChunks + list->nchunks, 0, sizeof(Chunk*) * (newSize - list->nchunks));
-        list->chunks = newChunks;
-        list->nchunks = newSize;
-    }
-    return true;
+static size_t numa_round(size_t size) {
+    size_t page = (size_t)numa_pagesize();
+    return (size + page - 1) & ~(page - 1);
 }
 
-static bool component_add_range(component_list* list, index_t index, index_t count, bitecs_ptrs begin, index_t* added)
-{
-    if (unlikely(!count)) return false;
-    if (unlikely(!list->meta.typesize)) {
-        *begin = NULL;
-        *added = count;
-        return true;
+static void* numa_map(NumaPool* pool, size_t size) {
+    void* res = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED) return NULL;
+    if (pool->node < 0) {
+        // failure: process policy is used
+        (void)mbind(res, size, MPOL_LOCAL, NULL, 0, 0);
+    } else {
+        numa_tonode_memory(res, size, pool->node);
     }
-    index_t chunk = index >> components_shift(list);
-    index_t i = index & fill_up_to(components_shift(list));
-    index_t diff = components_in_chunk(list) - i;
-    diff = diff > count ? count : diff;
-    Chunk* owner = list->chunks[chunk];
-    if (unlikely(!owner)) {
-        owner = malloc(chunk_sizeof(list));
-        memset(owner, 0, sizeof(Chunk));
-        if (unlikely(!owner)) {
-            *begin = NULL;
-            *added = 0;
-            return false;
-        }
+    return res;
+}
+
+static NumaBin* numa_bin(NumaPool* pool, size_t size, bool create) {
+    NumaBin* empty = NULL;
+    for (int i = 0; i < NUMA_BINS; ++i) {
+        NumaBin* bin = pool->bins + i;
+        if (bin->size == size) return bin;
+        if (!empty && !bin->head) empty = bin;
     }
-    list->chunks[chunk] = owner;
-    owner->header.nalives += diff;
-    *begin = owner->storage + i * list->meta.typesize;
-    *added = diff;
-    return true;
+    if (!create || !empty) return NULL;
+    empty->size = size;
+    return empty;
 }
 
-void *bitecs_entt_add_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
-{
-    component_list* list = reg->components[id];
-    if (!list) return NULL;
-    Entity* e = deref(reg, ptr);
-    if (!e) return NULL;
-    mask_t wasDict = e->dict;
-    mask_t wasComponents = e->components;
-    { //try to add to bitmask
-        if (!bitecs_mask_set((SparseMask*)e, id, true)) return NULL;
-        if (wasComponents == e->components) return NULL;
+// callers hold pool->lock
+static void* numa_slab_alloc(NumaPool* pool, size_t size) {
+    NumaBin* bin = numa_bin(pool, size, false);
+    if (bin && bin->head) {
+        NumaBlock* block = bin->head;
+        bin->head = block->next;
+        return block;
     }
-    void* begin = NULL;
-    index_t added;
-    if (likely(reserve_chunks(list, ptr.index, 1))) {
-        // no need to check here! begin wont get reassigned
-        (void)component_add_range(list, ptr.index, 1, &begin, &added);
+    if ((size_t)(pool->end - pool->top) < size) {
+        // tail of previous slab is lost
+        char* slab = numa_map(pool, NUMA_SLAB_SIZE);
+        if (unlikely(!slab)) return NULL;
+        pool->top = slab;
+        pool->end = slab + NUMA_SLAB_SIZE;
     }
-    if (unlikely(!begin)) {
-        e->dict = wasDict;
-        e->components = wasComponents;
+    void* res = pool->top;
+    pool->top += size;
+    return res;
+}
+
+static void numa_slab_free(NumaPool* pool, void* ptr, size_t size) {
+    size_t page = (size_t)numa_pagesize();
+    // pages are faulted in again (by policy of slab) on reuse
+    if (size > page) (void)madvise((char*)ptr + page, size - page, MADV_DONTNEED);
+    NumaBin* bin = numa_bin(pool, size, true);
+    if (unlikely(!bin)) {
+        // all bins are taken by other sizes: address range is lost
+        (void)madvise(ptr, page, MADV_DONTNEED);
+        return;
     }
-    return begin;
+    NumaBlock* block = ptr;
+    block->next = bin->head;
+    bin->head = block;
 }
 
-static void* deref_comp(component_list* list, index_t index)
-{
-    index_t chunk = index >> components_shift(list);
-    index_t i = index & fill_up_to(components_shift(list));
-    Chunk* owner = list->chunks[chunk];
-    return owner->storage + list->meta.typesize * i;
+static void* numa_chunk_alloc(void* udata, size_t size, size_t align, bitecs_AllocKind kind) {
+    if (!numa_mapped(size, kind)) return default_alloc(NULL, size, align, kind);
+    NumaPool* pool = udata;
+    size = numa_round(size);
+    if (size > NUMA_SLAB_MAX_CHUNK) return numa_map(pool, size);
+    pthread_mutex_lock(&pool->lock);
+    void* res = numa_slab_alloc(pool, size);
+    pthread_mutex_unlock(&pool->lock);
+    return res;
 }
 
-void *bitecs_entt_get_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
-{
-    Entity* e = deref(reg, ptr);
-    return e && bitecs_mask_get((SparseMask*)e, id) ? deref_comp(reg->components[id], ptr.index) : NULL;
+static void numa_chunk_free(void* udata, void* ptr, size_t size, size_t align, bitecs_AllocKind kind) {
+    if (!numa_mapped(size, kind)) {
+        default_free(NULL, ptr, size, align, kind);
+        return;
+    }
+    NumaPool* pool = udata;
+    size = numa_round(size);
+    if (size > NUMA_SLAB_MAX_CHUNK) {
+        munmap(ptr, size);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    numa_slab_free(pool, ptr, size);
+    pthread_mutex_unlock(&pool->lock);
 }
 
-bool bitecs_entt_remove_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
+bool bitecs_allocator_numa(bitecs_Allocator *out, int node)
 {
-    Entity* e = deref(reg, ptr);
+    if (numa_available() < 0 || node > numa_max_node() || node >= NUMA_MAX_POOLS - 1) return false;
+    pthread_once(&numa_pools_once, numa_pools_init);
+    NumaPool* pool = numa_pools + (node < 0 ? 0 : node + 1);
+    *out = (bitecs_Allocator){numa_chunk_alloc, numa_chunk_free, pool};
+    return true;
+}
+
+#else
+
+bool bitecs_allocator_numa(bitecs_Allocator *out, int node)
+{
+    (void)out; (void)node;
+    return false;
+}
+
+#endif
+
+typedef struct {
+    index_t index;
+    index_t count;
+} IndexRange;
+
+typedef struct component_list
+{
+    Chunk** chunks;
+    size_t nchunks;
+    // bitecs_storage_sparse: pages of entt index -> slot in dense
+    index_t** pages;
+    size_t npages;
+    char* dense;
+    index_t* dense_owners;
+    index_t ndense;
+    index_t dense_cap;
+    bitecs_ComponentMeta meta;
+    // bitecs_storage_double_buffered: chunks as of last bitecs_component_swap() (same as chunks[i],
+    // unless some system wrote into chunk since then). nchunks long
+    Chunk** prev;
+    // recycled previous chunks, chained through their storage
+    Chunk* spare;
+    // slots, added into written chunks: copied into prev, once initialized (see mirror_added())
+    IndexRange* added;
+    size_t nadded;
+    size_t added_cap;
+    // occupancy statistics (see bitecs_component_stats())
+    size_t nalives;
+    size_t chunk_allocs;
+    size_t chunk_frees;
+    // allocator of registry
+    const bitecs_Allocator* alloc;
+} component_list;
+
+static int components_shift(component_list* list) {
+    return list->meta.frequency + BITECS_FREQUENCY_ADJUST;
+}
+
+static size_t components_in_chunk(component_list* list) {
+    return (size_t)1 << components_shift(list);
+}
+
+static size_t chunk_sizeof(component_list* list) {
+    return components_in_chunk(list) * list->meta.typesize + sizeof(Chunk);
+}
+
+static Chunk* chunk_new(component_list* list) {
+    Chunk* res = list->alloc->alloc(list->alloc->udata, chunk_sizeof(list), CHUNK_ALIGN, bitecs_alloc_chunk);
+    if (unlikely(!res)) return res;
+    memset(res, 0, sizeof(Chunk));
+    atomic_init(&res->header.refs, 1);
+    list->chunk_allocs++;
+    return res;
+}
+
+static bool chunk_shared(Chunk* chunk) {
+    return atomic_load_explicit(&chunk->header.refs, memory_order_acquire) > 1;
+}
+
+// true: was the last owner
+static bool chunk_unref(Chunk* chunk) {
+    return atomic_fetch_sub_explicit(&chunk->header.refs, 1, memory_order_acq_rel) == 1;
+}
+
+static void chunk_dealloc(component_list* list, Chunk* chunk) {
+    list->alloc->free(list->alloc->udata, chunk, chunk_sizeof(list), CHUNK_ALIGN, bitecs_alloc_chunk);
+}
+
+// without statistics. Memory of chunk, shared with forks, goes away with its last owner
+static void chunk_release(component_list* list, Chunk* chunk) {
+    if (!chunk || !chunk_unref(chunk)) return;
+    chunk_dealloc(list, chunk);
+}
+
+static void chunk_free(component_list* list, Chunk* chunk) {
+    list->chunk_frees++;
+    chunk_release(list, chunk);
+}
+
+static component_list* components_new(bitecs_ComponentMeta meta, const bitecs_Allocator* alloc) {
+    component_list* res = mem_alloc(alloc, sizeof(component_list), bitecs_alloc_registry);
+    if (!res) return res;
+    *res = (component_list){0};
+    res->meta = meta;
+    res->alloc = alloc;
+    return res;
+}
+
+static bool is_sparse(component_list* list) {
+    return list->meta.storage == bitecs_storage_sparse;
+}
+
+static bool is_double_buffered(component_list* list) {
+    return list->meta.storage == bitecs_storage_double_buffered;
+}
+
+// first write into chunk since last swap: readers keep previous chunk, writer gets a copy of it
+static bool chunk_diverge(component_list* list, size_t chunk)
+{
+    Chunk* prev = list->prev[chunk];
+    if (list->chunks[chunk] != prev) return true;
+    Chunk* next = list->spare;
+    if (next) {
+        memcpy(&list->spare, next->storage, sizeof(Chunk*));
+    } else if (unlikely(!(next = chunk_new(list)))) {
+        return false;
+    }
+    next->header.nalives = prev->header.nalives;
+    memcpy(next->storage, prev->storage, components_in_chunk(list) * list->meta.typesize);
+    list->chunks[chunk] = next;
+    return true;
+}
+
+// pointer swap: written chunk becomes previous one, old previous is kept for next divergence
+static void chunk_settle(component_list* list, size_t chunk)
+{
+    Chunk* prev = list->prev[chunk];
+    if (prev == list->chunks[chunk]) return;
+    if (prev) {
+        memcpy(prev->storage, &list->spare, sizeof(Chunk*));
+        list->spare = prev;
+    }
+    list->prev[chunk] = list->chunks[chunk];
+}
+
+static bool added_push(component_list* list, index_t index, index_t count)
+{
+    if (list->nadded == list->added_cap) {
+        size_t cap = list->added_cap ? list->added_cap * 2 : 16;
+        IndexRange* grown = mem_alloc(list->alloc, sizeof(IndexRange) * cap, bitecs_alloc_index);
+        if (unlikely(!grown)) return false;
+        if (list->added) {
+            memcpy(grown, list->added, sizeof(IndexRange) * list->nadded);
+            mem_free(list->alloc, list->added, sizeof(IndexRange) * list->added_cap, bitecs_alloc_index);
+        }
+        list->added = grown;
+        list->added_cap = cap;
+    }
+    list->added[list->nadded++] = (IndexRange){index, count};
+    return true;
+}
+
+// new entts have no previous values: their initial ones are copied into previous chunk too
+static void mirror_added(component_list* list)
+{
+    for (size_t i = 0; i < list->nadded; ++i) {
+        index_t index = list->added[i].index;
+        size_t chunk = index >> components_shift(list);
+        Chunk* prev = list->prev[chunk];
+        if (!prev || prev == list->chunks[chunk]) continue;
+        size_t offset = (size_t)(index & fill_up_to(components_shift(list))) * list->meta.typesize;
+        memcpy(prev->storage + offset, list->chunks[chunk]->storage + offset,
+               (size_t)list->added[i].count * list->meta.typesize);
+    }
+    list->nadded = 0;
+}
+
+static index_t sparse_slot(component_list* list, index_t index) {
+    size_t page = index >> SPARSE_PAGE_SHIFT;
+    if (unlikely(page >= list->npages || !list->pages[page])) return sparse_none;
+    return list->pages[page][index & fill_up_to(SPARSE_PAGE_SHIFT)];
+}
+
+static void sparse_set_slot(component_list* list, index_t index, index_t slot) {
+    list->pages[index >> SPARSE_PAGE_SHIFT][index & fill_up_to(SPARSE_PAGE_SHIFT)] = slot;
+}
+
+static void* sparse_at(component_list* list, index_t slot) {
+    return list->dense + (size_t)slot * list->meta.typesize;
+}
+
+static void relocate(component_list* list, void* from, index_t count, void* into) {
+    if (list->meta.relocater) {
+        list->meta.relocater(from, count, into);
+    } else {
+        memcpy(into, from, count * list->meta.typesize);
+    }
+}
+
+static bool sparse_reserve_pages(component_list* list, index_t index, index_t count)
+{
+    size_t last = (index + count - 1) >> SPARSE_PAGE_SHIFT;
+    if (list->npages <= last) {
+        size_t newSize = last + 1;
+        index_t** newPages = mem_alloc(list->alloc, sizeof(index_t*) * newSize, bitecs_alloc_index);
+        if (unlikely(!newPages)) return false;
+        if (list->pages) {
+            memcpy(newPages, list->pages, sizeof(index_t*) * list->npages);
+            mem_free(list->alloc, list->pages, sizeof(index_t*) * list->npages, bitecs_alloc_index);
+        }
+        memset(newPages + list->npages, 0, sizeof(index_t*) * (newSize - list->npages));
+        list->pages = newPages;
+        list->npages = newSize;
+    }
+    for (size_t page = index >> SPARSE_PAGE_SHIFT; page <= last; ++page) {
+        if (list->pages[page]) continue;
+        index_t* fresh = mem_alloc(list->alloc, sizeof(index_t) * SPARSE_PAGE_SIZE, bitecs_alloc_index);
+        if (unlikely(!fresh)) return false;
+        memset(fresh, 0xFF, sizeof(index_t) * SPARSE_PAGE_SIZE);
+        list->pages[page] = fresh;
+    }
+    return true;
+}
+
+static bool sparse_reserve_dense(component_list* list, index_t count)
+{
+    if (list->ndense + count <= list->dense_cap) return true;
+    index_t newCap = list->dense_cap * 1.7;
+    if (newCap < list->ndense + count) newCap = list->ndense + count;
+    char* newDense = mem_alloc(list->alloc, (size_t)newCap * list->meta.typesize, bitecs_alloc_index);
+    index_t* newOwners = mem_alloc(list->alloc, sizeof(index_t) * newCap, bitecs_alloc_index);
+    if (unlikely(!newDense || !newOwners)) {
+        mem_free(list->alloc, newDense, (size_t)newCap * list->meta.typesize, bitecs_alloc_index);
+        mem_free(list->alloc, newOwners, sizeof(index_t) * newCap, bitecs_alloc_index);
+        return false;
+    }
+    if (list->ndense) {
+        relocate(list, list->dense, list->ndense, newDense);
+        memcpy(newOwners, list->dense_owners, sizeof(index_t) * list->ndense);
+    }
+    mem_free(list->alloc, list->dense, (size_t)list->dense_cap * list->meta.typesize, bitecs_alloc_index);
+    mem_free(list->alloc, list->dense_owners, sizeof(index_t) * list->dense_cap, bitecs_alloc_index);
+    list->dense = newDense;
+    list->dense_owners = newOwners;
+    list->dense_cap = newCap;
+    return true;
+}
+
+static bool sparse_add_range(component_list* list, index_t index, index_t count, bitecs_ptrs begin)
+{
+    if (unlikely(!sparse_reserve_pages(list, index, count) || !sparse_reserve_dense(list, count))) {
+        *begin = NULL;
+        return false;
+    }
+    index_t slot = list->ndense;
+    for (index_t i = 0; i < count; ++i) {
+        sparse_set_slot(list, index + i, slot + i);
+        list->dense_owners[slot + i] = index + i;
+    }
+    list->ndense += count;
+    *begin = sparse_at(list, slot);
+    return true;
+}
+
+// [slot; slot + count) must be already destroyed. Tail is moved into the hole
+static void sparse_erase(component_list* list, index_t slot, index_t count)
+{
+    for (index_t i = slot; i < slot + count; ++i) {
+        sparse_set_slot(list, list->dense_owners[i], sparse_none);
+    }
+    index_t after = list->ndense - (slot + count);
+    index_t moved = after < count ? after : count;
+    if (moved) {
+        index_t from = list->ndense - moved;
+        relocate(list, sparse_at(list, from), moved, sparse_at(list, slot));
+        for (index_t i = 0; i < moved; ++i) {
+            index_t owner = list->dense_owners[from + i];
+            list->dense_owners[slot + i] = owner;
+            sparse_set_slot(list, owner, slot + i);
+        }
+    }
+    list->ndense -= count;
+}
+
+static void components_free_storage(component_list* list)
+{
+    for (size_t i = 0; i < list->nchunks; ++i) {
+        if (list->prev && list->prev[i] != list->chunks[i]) chunk_release(list, list->prev[i]);
+        chunk_release(list, list->chunks[i]);
+    }
+    while (list->spare) {
+        Chunk* next;
+        memcpy(&next, list->spare->storage, sizeof(Chunk*));
+        chunk_release(list, list->spare);
+        list->spare = next;
+    }
+    mem_free(list->alloc, list->chunks, sizeof(Chunk*) * list->nchunks, bitecs_alloc_index);
+    mem_free(list->alloc, list->prev, sizeof(Chunk*) * list->nchunks, bitecs_alloc_index);
+    mem_free(list->alloc, list->added, sizeof(IndexRange) * list->added_cap, bitecs_alloc_index);
+    for (size_t i = 0; i < list->npages; ++i) {
+        mem_free(list->alloc, list->pages[i], sizeof(index_t) * SPARSE_PAGE_SIZE, bitecs_alloc_index);
+    }
+    mem_free(list->alloc, list->pages, sizeof(index_t*) * list->npages, bitecs_alloc_index);
+    mem_free(list->alloc, list->dense, (size_t)list->dense_cap * list->meta.typesize, bitecs_alloc_index);
+    mem_free(list->alloc, list->dense_owners, sizeof(index_t) * list->dense_cap, bitecs_alloc_index);
+}
+
+static void components_destroy_trivial(component_list* list)
+{
+    if (!list) return;
+    components_free_storage(list);
+    mem_free(list->alloc, list, sizeof(component_list), bitecs_alloc_registry);
+}
+
+typedef struct FreeList
+{
+    index_t index;
+    index_t count;
+    struct FreeList* prev;
+    struct FreeList* next;
+} FreeList;
+
+
+// take [count] slots from head or tail of node. node is removed when exhausted
+static index_t take_from_node(const bitecs_Allocator* alloc, FreeList** _list, FreeList* node, index_t count, bool tail) {
+    index_t result;
+    if (node->count > count) {
+        node->count -= count;
+        if (tail) {
+            result = node->index + node->count;
+        } else {
+            result = node->index;
+            node->index += count;
+        }
+        return result;
+    }
+    result = node->index;
+    if (node->prev) node->prev->next = node->next;
+    if (node->next) node->next->prev = node->prev;
+    if (*_list == node) *_list = node->next;
+    mem_free(alloc, node, sizeof(FreeList), bitecs_alloc_index);
+    return result;
+}
+
+_BITECS_NODISCARD
+static bool take_free(const bitecs_Allocator* alloc, FreeList** _list, index_t count, index_t* outIndex) {
+    for (FreeList* list = *_list; list; list = list->next) {
+        if (list->count >= count) {
+            *outIndex = take_from_node(alloc, _list, list, count, false);
+            return true;
+        }
+    }
+    return false;
+}
+
+// list is sorted by index, adjacent ranges are coalesced. hint (may be NULL): node to continue search
+// from, when ranges are added in ascending order (one pass for whole batch). Gets node, that took range
+_BITECS_NODISCARD
+static bool add_free(const bitecs_Allocator* alloc, FreeList** _list, FreeList** hint, index_t index, index_t count) {
+    FreeList* prev = hint && *hint && (*hint)->index < index ? *hint : NULL;
+    FreeList* next = prev ? prev->next : *_list;
+    while (next && next->index < index) {
+        prev = next;
+        next = next->next;
+    }
+    bool mergePrev = prev && prev->index + prev->count == index;
+    bool mergeNext = next && index + count == next->index;
+    FreeList* res;
+    if (mergePrev && mergeNext) {
+        prev->count += count + next->count;
+        prev->next = next->next;
+        if (next->next) next->next->prev = prev;
+        mem_free(alloc, next, sizeof(FreeList), bitecs_alloc_index);
+        res = prev;
+    } else if (mergePrev) {
+        prev->count += count;
+        res = prev;
+    } else if (mergeNext) {
+        next->index = index;
+        next->count += count;
+        res = next;
+    } else {
+        res = mem_alloc(alloc, sizeof(FreeList), bitecs_alloc_index);
+        if (!res) return false;
+        res->index = index;
+        res->count = count;
+        res->prev = prev;
+        res->next = next;
+        *(prev ? &prev->next : _list) = res;
+        if (next) next->prev = res;
+    }
+    if (hint) *hint = res;
+    return true;
+}
+
+// component metas, shared by registries (plain malloc: registries may have different allocators)
+
+typedef struct {
+    bitecs_ComponentMeta metas[BITECS_GROUP_SIZE];
+    bool defined[BITECS_GROUP_SIZE];
+} SchemaGroup;
+
+struct bitecs_schema
+{
+    _Atomic(size_t) refs;
+    // allocated on first define in group
+    SchemaGroup* groups[BITECS_BITS_IN_DICT];
+};
+
+bitecs_schema* bitecs_schema_new(void)
+{
+    bitecs_schema* schema = calloc(1, sizeof(bitecs_schema));
+    if (unlikely(!schema)) return NULL;
+    atomic_init(&schema->refs, 1);
+    return schema;
+}
+
+bitecs_schema* bitecs_schema_retain(bitecs_schema *schema)
+{
+    if (schema) atomic_fetch_add_explicit(&schema->refs, 1, memory_order_relaxed);
+    return schema;
+}
+
+void bitecs_schema_release(bitecs_schema *schema)
+{
+    if (!schema || atomic_fetch_sub_explicit(&schema->refs, 1, memory_order_acq_rel) != 1) return;
+    for (int i = 0; i < BITECS_BITS_IN_DICT; ++i) {
+        free(schema->groups[i]);
+    }
+    free(schema);
+}
+
+static bool schema_shared(bitecs_schema* schema) {
+    return atomic_load_explicit(&schema->refs, memory_order_acquire) > 1;
+}
+
+static const bitecs_ComponentMeta* schema_meta(const bitecs_schema* schema, bitecs_comp_id_t id) {
+    if (!schema) return NULL;
+    const SchemaGroup* group = schema->groups[id >> BITECS_GROUP_SHIFT];
+    int i = id & fill_up_to(BITECS_GROUP_SHIFT);
+    return group && group->defined[i] ? group->metas + i : NULL;
+}
+
+bool bitecs_schema_define(bitecs_schema *schema, bitecs_comp_id_t id, bitecs_ComponentMeta meta)
+{
+    if (schema_shared(schema) || schema_meta(schema, id)) return false;
+    if (meta.storage == bitecs_storage_double_buffered) {
+        // buffers are copied and recycled raw
+        bool trivial = !meta.deleter && !meta.relocater && !meta.copier;
+        if (!meta.typesize || !trivial || meta.auto_frequency) return false;
+    }
+    SchemaGroup** group = schema->groups + (id >> BITECS_GROUP_SHIFT);
+    if (!*group && unlikely(!(*group = calloc(1, sizeof(SchemaGroup))))) return false;
+    int i = id & fill_up_to(BITECS_GROUP_SHIFT);
+    (*group)->metas[i] = meta;
+    (*group)->defined[i] = true;
+    return true;
+}
+
+static bitecs_schema* schema_copy(const bitecs_schema* schema)
+{
+    bitecs_schema* res = bitecs_schema_new();
+    if (unlikely(!res) || !schema) return res;
+    for (int i = 0; i < BITECS_BITS_IN_DICT; ++i) {
+        if (!schema->groups[i]) continue;
+        res->groups[i] = malloc(sizeof(SchemaGroup));
+        if (unlikely(!res->groups[i])) {
+            bitecs_schema_release(res);
+            return NULL;
+        }
+        *res->groups[i] = *schema->groups[i];
+    }
+    return res;
+}
+
+struct bitecs_registry
+{
+    Entity* entities;
+    FreeList* freeList;
+    index_t entities_count;
+    index_t entities_cap;
+    index_t total_free;
+    bitecs_Placement placement;
+    bitecs_Allocator alloc;
+    // owned by mapped registry (see mapped_alloc())
+    MappedArena* arena;
+    // set on both sides by bitecs_registry_fork(): chunks may be shared (copy-on-write)
+    bool forked;
+    // owners of shared entity table. NULL: not shared
+    _Atomic(size_t)* entities_refs;
+    bitecs_generation_t generation;
+    // NULL until first bitecs_component_define()
+    bitecs_schema* schema;
+    // storage of used components only: allocated per group of BITECS_GROUP_SIZE ids
+    component_list** components[BITECS_BITS_IN_DICT];
+    _Atomic(bool) chunks_cleanup_pending;
+    // bitecs_entt_add_component() into written double-buffered chunk (see registry_mirror())
+    bool mirror_pending;
+    // ring buffer of bitecs_SystemTrace (BITECS_PROFILE)
+    bitecs_SystemTrace* traces;
+    size_t traces_cap;
+    _Atomic(size_t) traces_head;
+};
+
+static component_list* reg_list(const bitecs_registry* reg, bitecs_comp_id_t id) {
+    component_list** group = reg->components[id >> BITECS_GROUP_SHIFT];
+    return group ? group[id & fill_up_to(BITECS_GROUP_SHIFT)] : NULL;
+}
+
+static component_list** reg_list_slot(bitecs_registry* reg, bitecs_comp_id_t id) {
+    component_list*** group = reg->components + (id >> BITECS_GROUP_SHIFT);
+    if (!*group) {
+        *group = mem_alloc(&reg->alloc, sizeof(component_list*) * BITECS_GROUP_SIZE, bitecs_alloc_registry);
+        if (unlikely(!*group)) return NULL;
+        memset(*group, 0, sizeof(component_list*) * BITECS_GROUP_SIZE);
+    }
+    return *group + (id & fill_up_to(BITECS_GROUP_SHIFT));
+}
+
+// storage of component is created on first use. NULL: not defined (or OOM)
+static component_list* reg_list_use(bitecs_registry* reg, bitecs_comp_id_t id) {
+    component_list* list = reg_list(reg, id);
+    if (likely(list)) return list;
+    const bitecs_ComponentMeta* meta = schema_meta(reg->schema, id);
+    if (!meta) return NULL;
+    component_list** slot = reg_list_slot(reg, id);
+    if (unlikely(!slot)) return NULL;
+    return *slot = components_new(*meta, &reg->alloc);
+}
+
+// components, added by bitecs_entt_add_component(), got initialized by now. Called before
+// previous buffers are read (single threaded: before systems are started)
+static void registry_mirror(bitecs_registry* reg)
+{
+    if (likely(!reg->mirror_pending)) return;
+    reg->mirror_pending = false;
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* list = reg_list(reg, comp);
+        if (list && list->nadded) mirror_added(list);
+    }
+}
+
+// mapped registry is reopened from file alone: plain data in chunks only
+static bool mapped_meta_ok(const bitecs_ComponentMeta* meta) {
+    return !meta->deleter && !meta->relocater && !meta->copier && meta->storage == bitecs_storage_chunked;
+}
+
+bool bitecs_component_define(bitecs_registry* reg, bitecs_comp_id_t id, bitecs_ComponentMeta meta)
+{
+    assert(meta.typesize >= 0);
+    if (schema_meta(reg->schema, id)) return false;
+    if (reg->arena && !mapped_meta_ok(&meta)) return false;
+    if (!reg->schema || schema_shared(reg->schema)) {
+        // schema is immutable, while shared: this registry gets own copy
+        bitecs_schema* own = schema_copy(reg->schema);
+        if (unlikely(!own)) return false;
+        bitecs_schema_release(reg->schema);
+        reg->schema = own;
+    }
+    return bitecs_schema_define(reg->schema, id, meta);
+}
+
+bitecs_schema* bitecs_registry_schema(bitecs_registry *reg)
+{
+    return reg->schema;
+}
+
+bitecs_registry* bitecs_registry_new(void)
+{
+    return bitecs_registry_new_with(NULL);
+}
+
+bitecs_registry* bitecs_registry_new_with(const bitecs_Allocator* alloc)
+{
+    return bitecs_registry_new_schema(NULL, alloc);
+}
+
+bitecs_registry* bitecs_registry_new_schema(bitecs_schema *schema, const bitecs_Allocator *alloc)
+{
+    if (!alloc) alloc = &default_allocator;
+    bitecs_registry* result = mem_alloc(alloc, sizeof(bitecs_registry), bitecs_alloc_registry);
+    if (!result) return result;
+    *result = (bitecs_registry){0};
+    result->alloc = *alloc;
+    result->schema = bitecs_schema_retain(schema);
+    return result;
+}
+
+bitecs_registry* bitecs_registry_new_mapped(const char *path, size_t capacity)
+{
+    MappedArena* arena = arena_open(path, capacity);
+    if (!arena) return NULL;
+    bitecs_Allocator alloc = {mapped_alloc, mapped_free, arena};
+    bitecs_registry* result = bitecs_registry_new_with(&alloc);
+    if (!result) {
+        arena_close(arena);
+        return NULL;
+    }
+    result->arena = arena;
+    return result;
+}
+
+static uint64_t mapped_offset(MappedArena* arena, const void* ptr) {
+    return ptr ? (uint64_t)((const char*)ptr - arena->base) : 0;
+}
+
+static void* mapped_ptr(MappedArena* arena, uint64_t offset) {
+    return offset ? arena->base + offset : NULL;
+}
+
+// chunks and entity table stay in file, rest of registry is written next to them (offsets in header).
+// false: file is full (it is not reopenable then)
+static bool registry_persist(bitecs_registry* reg)
+{
+    MappedArena* arena = reg->arena;
+    MappedHeader header = {0};
+    header.page = arena->page;
+    header.entity_size = sizeof(Entity);
+    header.entities = mapped_offset(arena, reg->entities);
+    header.entities_count = reg->entities_count;
+    header.entities_cap = reg->entities_cap;
+    header.generation = reg->generation;
+    header.placement = reg->placement;
+    for (FreeList* node = reg->freeList; node; node = node->next) header.nfree++;
+    if (header.nfree) {
+        IndexRange* free = arena_alloc(arena, sizeof(IndexRange) * header.nfree);
+        if (unlikely(!free)) return false;
+        header.free = mapped_offset(arena, free);
+        for (FreeList* node = reg->freeList; node; node = node->next) {
+            *free++ = (IndexRange){node->index, node->count};
+        }
+    }
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        header.ncomponents += reg_list(reg, comp) != NULL;
+    }
+    if (header.ncomponents) {
+        MappedComponent* comps = arena_alloc(arena, sizeof(MappedComponent) * header.ncomponents);
+        if (unlikely(!comps)) return false;
+        header.components = mapped_offset(arena, comps);
+        for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+            component_list* list = reg_list(reg, comp);
+            if (!list) continue;
+            MappedComponent* out = comps++;
+            *out = (MappedComponent){
+                (uint64_t)comp, list->meta.typesize, list->meta.frequency, list->meta.auto_frequency, list->nchunks, 0
+            };
+            if (!list->nchunks) continue;
+            uint64_t* chunks = arena_alloc(arena, sizeof(uint64_t) * list->nchunks);
+            if (unlikely(!chunks)) return false;
+            out->chunks = mapped_offset(arena, chunks);
+            for (size_t i = 0; i < list->nchunks; ++i) {
+                chunks[i] = mapped_offset(arena, list->chunks[i]);
+            }
+        }
+    }
+    // last: allocations may only take holes away
+    header.holes_reserved = arena->nholes;
+    if (header.holes_reserved) {
+        ArenaRange* holes = arena_alloc(arena, sizeof(ArenaRange) * header.holes_reserved);
+        if (unlikely(!holes)) return false;
+        header.holes = mapped_offset(arena, holes);
+        header.nholes = arena->nholes;
+        memcpy(holes, arena->holes, sizeof(ArenaRange) * arena->nholes);
+    }
+    header.top = arena->top;
+    memcpy(header.bins, arena->bins, sizeof(header.bins));
+    header.magic = ARENA_MAGIC;
+    *arena_header(arena) = header;
+    return true;
+}
+
+// file keeps chunks and entity table: registry lets go of them
+static void registry_detach_mapped(bitecs_registry* reg)
+{
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* list = reg_list(reg, comp);
+        if (list && list->chunks) memset(list->chunks, 0, sizeof(Chunk*) * list->nchunks);
+    }
+    reg->entities = NULL;
+}
+
+bitecs_registry* bitecs_registry_open_mapped(const char *path)
+{
+    MappedArena* arena = arena_reopen(path);
+    if (!arena) return NULL;
+    bitecs_Allocator alloc = {mapped_alloc, mapped_free, arena};
+    bitecs_registry* reg = bitecs_registry_new_with(&alloc);
+    if (!reg) {
+        arena_close(arena);
+        return NULL;
+    }
+    reg->arena = arena;
+    MappedHeader* header = arena_header(arena);
+    const MappedComponent* comps = mapped_ptr(arena, header->components);
+    for (size_t ci = 0; ci < header->ncomponents; ++ci) {
+        const MappedComponent* stored = comps + ci;
+        bitecs_comp_id_t id = (bitecs_comp_id_t)stored->id;
+        bitecs_ComponentMeta meta = {0};
+        meta.typesize = stored->typesize;
+        meta.frequency = (bitecs_Frequency)stored->frequency;
+        meta.auto_frequency = stored->auto_frequency != 0;
+        if (!bitecs_component_define(reg, id, meta)) goto fail;
+        component_list* list = reg_list_use(reg, id);
+        if (unlikely(!list)) goto fail;
+        if (!stored->nchunks) continue;
+        list->chunks = mem_alloc(&reg->alloc, sizeof(Chunk*) * stored->nchunks, bitecs_alloc_index);
+        if (unlikely(!list->chunks)) goto fail;
+        list->nchunks = stored->nchunks;
+        const uint64_t* chunks = mapped_ptr(arena, stored->chunks);
+        for (size_t i = 0; i < list->nchunks; ++i) {
+            Chunk* chunk = list->chunks[i] = mapped_ptr(arena, chunks[i]);
+            if (!chunk) continue;
+            list->chunk_allocs++;
+            list->nalives += chunk->header.nalives;
+        }
+    }
+    reg->entities = mapped_ptr(arena, header->entities);
+    reg->entities_count = (index_t)header->entities_count;
+    reg->entities_cap = (index_t)header->entities_cap;
+    reg->generation = (generation_t)header->generation;
+    reg->placement = (bitecs_Placement)header->placement;
+    const IndexRange* free = mapped_ptr(arena, header->free);
+    FreeList* hint = NULL;
+    for (size_t i = 0; i < header->nfree; ++i) {
+        if (unlikely(!add_free(&reg->alloc, &reg->freeList, &hint, free[i].index, free[i].count))) goto fail;
+        reg->total_free += free[i].count;
+    }
+    // empty chunks may have been left for cleanup
+    atomic_store_explicit(&reg->chunks_cleanup_pending, true, memory_order_relaxed);
+    // rest of stored registry goes back to arena
+    for (size_t ci = 0; ci < header->ncomponents; ++ci) {
+        if (!comps[ci].nchunks) continue;
+        arena_free(arena, mapped_ptr(arena, comps[ci].chunks), sizeof(uint64_t) * comps[ci].nchunks);
+    }
+    if (header->ncomponents) arena_free(arena, (void*)comps, sizeof(MappedComponent) * header->ncomponents);
+    if (header->nfree) arena_free(arena, (void*)free, sizeof(IndexRange) * header->nfree);
+    if (header->holes_reserved) {
+        arena_free(arena, mapped_ptr(arena, header->holes), sizeof(ArenaRange) * header->holes_reserved);
+    }
+    // until next bitecs_registry_delete()
+    header->magic = 0;
+    return reg;
+fail:
+    registry_detach_mapped(reg);
+    reg->arena = NULL;
+    bitecs_registry_delete(reg);
+    arena_close(arena);
+    return NULL;
+}
+
+
+void bitecs_registry_set_placement(bitecs_registry *reg, bitecs_Placement placement)
+{
+    reg->placement = placement;
+}
+
+static bool same_archetype(const bitecs_registry* reg, index_t index, const SparseMask* mask) {
+    if (index >= reg->entities_count) return false;
+    const Entity* e = reg->entities + index;
+    return e->dict == mask->dict && e->components == mask->bits;
+}
+
+// prefer hole, that continues run of same archetype (on either side). Fallback to first fit
+_BITECS_NODISCARD
+static bool take_free_near(bitecs_registry* reg, const SparseMask* mask, index_t count, index_t* outIndex) {
+    FreeList* firstFit = NULL;
+    for (FreeList* node = reg->freeList; node; node = node->next) {
+        if (node->count < count) continue;
+        if (node->index && same_archetype(reg, node->index - 1, mask)) {
+            *outIndex = take_from_node(&reg->alloc, &reg->freeList, node, count, false);
+            return true;
+        }
+        if (same_archetype(reg, node->index + node->count, mask)) {
+            *outIndex = take_from_node(&reg->alloc, &reg->freeList, node, count, true);
+            return true;
+        }
+        if (!firstFit) firstFit = node;
+    }
+    if (!firstFit) return false;
+    *outIndex = take_from_node(&reg->alloc, &reg->freeList, firstFit, count, false);
+    return true;
+}
+
+static bool next_component_run(const Entity* entts, index_t count, bitecs_comp_id_t id, index_t* cursor, index_t* end);
+static bool component_remove_range(component_list* list, index_t index, index_t count);
+
+static void components_destroy(bitecs_registry* reg, bitecs_comp_id_t id)
+{
+    component_list* list = reg_list(reg, id);
+    index_t cursor = 0;
+    index_t end;
+    while (next_component_run(reg->entities, reg->entities_count, id, &cursor, &end)) {
+        (void)component_remove_range(list, cursor, end - cursor);
+        cursor = end;
+    }
+    components_destroy_trivial(list);
+}
+
+// destroy alive components in chunk (entity table of reg still describes it)
+static void chunk_destroy_alive(bitecs_registry* reg, bitecs_comp_id_t id, size_t chunk, Chunk* owner)
+{
+    component_list* list = reg_list(reg, id);
+    index_t base = (index_t)(chunk << components_shift(list));
+    index_t count = base + components_in_chunk(list);
+    count = count < reg->entities_count ? count : reg->entities_count;
+    index_t cursor = base;
+    index_t end;
+    while (next_component_run(reg->entities, count, id, &cursor, &end)) {
+        list->meta.deleter(owner->storage + (size_t)(cursor - base) * list->meta.typesize, end - cursor);
+        cursor = end;
+    }
+}
+
+// forked registry: components are destroyed only in chunks, not shared anymore
+static void components_drop(bitecs_registry* reg, bitecs_comp_id_t id)
+{
+    component_list* list = reg_list(reg, id);
+    for (size_t i = 0; i < list->nchunks; ++i) {
+        Chunk* owner = list->chunks[i];
+        list->chunks[i] = NULL;
+        if (!owner || !chunk_unref(owner)) continue;
+        chunk_destroy_alive(reg, id, i, owner);
+        chunk_dealloc(list, owner);
+    }
+    components_destroy_trivial(list);
+}
+
+static void entities_free(bitecs_registry* reg)
+{
+    if (reg->entities_refs) {
+        if (atomic_fetch_sub_explicit(reg->entities_refs, 1, memory_order_acq_rel) != 1) return;
+        mem_free(&reg->alloc, reg->entities_refs, sizeof(size_t), bitecs_alloc_index);
+    }
+    mem_free(&reg->alloc, reg->entities, sizeof(Entity) * reg->entities_cap, bitecs_alloc_entities);
+}
+
+void bitecs_registry_delete(bitecs_registry* reg)
+{
+    if (!reg) return;
+    // mapped: chunks and entity table stay in file for bitecs_registry_open_mapped()
+    if (reg->arena && registry_persist(reg)) registry_detach_mapped(reg);
+    for (int i = 0; i < BITECS_MAX_COMPONENTS; ++i) {
+        component_list* list = reg_list(reg, i);
+        if (!list) continue;
+        if (list->meta.deleter && reg->forked && !is_sparse(list)) {
+            components_drop(reg, i);
+        } else if (list->meta.deleter) {
+            components_destroy(reg, i);
+        } else {
+            components_destroy_trivial(list);
+        }
+    }
+    for (int i = 0; i < BITECS_BITS_IN_DICT; ++i) {
+        if (!reg->components[i]) continue;
+        mem_free(&reg->alloc, reg->components[i], sizeof(component_list*) * BITECS_GROUP_SIZE, bitecs_alloc_registry);
+    }
+    bitecs_schema_release(reg->schema);
+    entities_free(reg);
+    mem_free(&reg->alloc, reg->traces, sizeof(bitecs_SystemTrace) * reg->traces_cap, bitecs_alloc_temp);
+    FreeList* list = reg->freeList;
+    while (list) {
+        FreeList* next = list->next;
+        mem_free(&reg->alloc, list, sizeof(FreeList), bitecs_alloc_index);
+        list = next;
+    }
+    bitecs_Allocator alloc = reg->alloc;
+    MappedArena* arena = reg->arena;
+    *reg = (bitecs_registry){0};
+    mem_free(&alloc, reg, sizeof(bitecs_registry), bitecs_alloc_registry);
+    arena_close(arena);
+}
+
+static bool has_component(const Entity* e, bitecs_comp_id_t id) {
+    return e->dict != dead_entt && bitecs_mask_get((const SparseMask*)e, id);
+}
+
+// find next run [*cursor; *end) of alive entts with component
+static bool next_component_run(const Entity* entts, index_t count, bitecs_comp_id_t id, index_t* cursor, index_t* end)
+{
+    index_t begin = *cursor;
+    while (begin < count && !has_component(entts + begin, id)) {
+        begin++;
+    }
+    if (begin == count) return false;
+    index_t last = begin + 1;
+    while (last < count && has_component(entts + last, id)) {
+        last++;
+    }
+    *cursor = begin;
+    *end = last;
+    return true;
+}
+
+// copy-on-write (bitecs_registry_fork()). Shared chunk is copied by the first registry,
+// that modifies it. Must be called before entity table changes, that concern this chunk
+static bool chunk_own(bitecs_registry* reg, bitecs_comp_id_t id, size_t chunk)
+{
+    component_list* list = reg_list(reg, id);
+    Chunk* shared = list->chunks[chunk];
+    if (!shared || !chunk_shared(shared)) return true;
+    Chunk* copy = chunk_new(list);
+    if (unlikely(!copy)) return false;
+    copy->header.nalives = shared->header.nalives;
+    if (list->meta.copier) {
+        index_t base = (index_t)(chunk << components_shift(list));
+        index_t count = base + components_in_chunk(list);
+        count = count < reg->entities_count ? count : reg->entities_count;
+        index_t cursor = base;
+        index_t end;
+        while (next_component_run(reg->entities, count, id, &cursor, &end)) {
+            size_t offset = (size_t)(cursor - base) * list->meta.typesize;
+            list->meta.copier(shared->storage + offset, end - cursor, copy->storage + offset);
+            cursor = end;
+        }
+    } else {
+        memcpy(copy->storage, shared->storage, components_in_chunk(list) * list->meta.typesize);
+    }
+    list->chunks[chunk] = copy;
+    list->chunk_frees++;
+    if (unlikely(chunk_unref(shared))) {
+        // forks let go of it meanwhile
+        if (list->meta.deleter) chunk_destroy_alive(reg, id, chunk, shared);
+        chunk_dealloc(list, shared);
+    }
+    return true;
+}
+
+// chunks of component, that hold [index; index + count)
+static bool chunks_own(bitecs_registry* reg, bitecs_comp_id_t id, index_t index, index_t count)
+{
+    component_list* list = reg_list(reg, id);
+    if (likely(!reg->forked) || !list || !count || !list->meta.typesize || is_sparse(list)) return true;
+    size_t last = (size_t)(index + count - 1) >> components_shift(list);
+    for (size_t chunk = index >> components_shift(list); chunk <= last && chunk < list->nchunks; ++chunk) {
+        if (unlikely(!chunk_own(reg, id, chunk))) return false;
+    }
+    return true;
+}
+
+static bool entities_own(bitecs_registry* reg)
+{
+    _Atomic(size_t)* refs = reg->entities_refs;
+    if (likely(!refs)) return true;
+    if (atomic_load_explicit(refs, memory_order_acquire) > 1) {
+        Entity* copy = mem_alloc(&reg->alloc, sizeof(Entity) * reg->entities_cap, bitecs_alloc_entities);
+        if (unlikely(!copy)) return false;
+        memcpy(copy, reg->entities, sizeof(Entity) * reg->entities_count);
+        Entity* shared = reg->entities;
+        reg->entities = copy;
+        reg->entities_refs = NULL;
+        if (atomic_fetch_sub_explicit(refs, 1, memory_order_acq_rel) != 1) return true;
+        mem_free(&reg->alloc, shared, sizeof(Entity) * reg->entities_cap, bitecs_alloc_entities);
+    }
+    reg->entities_refs = NULL;
+    mem_free(&reg->alloc, refs, sizeof(size_t), bitecs_alloc_index);
+    return true;
+}
+
+// before structural change of [index; index + count) for listed components
+static bool registry_own(bitecs_registry* reg, const int* comps, int ncomps, index_t index, index_t count)
+{
+    if (likely(!reg->forked)) return true;
+    if (unlikely(!entities_own(reg))) return false;
+    for (int i = 0; i < ncomps; ++i) {
+        if (unlikely(!chunks_own(reg, comps[i], index, count))) return false;
+    }
+    return true;
+}
+
+static index_t select_up_to_chunk(component_list* list, index_t begin, index_t count, bitecs_ptrs outBegin)
+{
+    if (unlikely(!list->meta.typesize)) {
+        *outBegin = 0;
+        return count;
+    }
+    if (unlikely(is_sparse(list))) {
+        index_t slot = sparse_slot(list, begin);
+        assert(slot != sparse_none && "Attempt to select missing sparse component (mask of component lies?)");
+        *outBegin = sparse_at(list, slot);
+        index_t run = 1;
+        while (run < count && sparse_slot(list, begin + run) == slot + run) {
+            run++;
+        }
+        return run;
+    }
+    index_t chunk = begin >> components_shift(list);
+    index_t i = begin & fill_up_to(components_shift(list));
+    char* chunkBegin = list->chunks[chunk]->storage;
+    assert(chunkBegin && "Attempt to select from NULL chunk (mask of component lies?)");
+    *outBegin = chunkBegin + i * list->meta.typesize;
+    index_t chunkTail = components_in_chunk(list) - i;
+    return count > chunkTail ? chunkTail : count;
+}
+
+typedef struct
+{
+    bitecs_SparseMask query;
+    bitecs_Ranks ranks;
+    bitecs_flags_t flags;
+} QueryCtx;
+
+typedef struct
+{
+    bitecs_ptrs ptrStorage; //should have space for void*[ncomps]
+    const int* components;
+    int ncomps;
+    // see select_components()
+    uint64_t writes;
+    bitecs_Callback system;
+    void* udata;
+    QueryCtx queryContext;
+    bitecs_index_t cursor;
+    // end of current matching run (cursor == run_end: look for next run)
+    bitecs_index_t run_end;
+    // > 0: run is matched only up to end of aligned window of 1 << window_shift entts
+    int window_shift;
+    Entity* begin;
+    bitecs_index_t count;
+#ifdef BITECS_PROFILE
+    bitecs_index_t matched;
+    bitecs_index_t runs;
+#endif
+} StepCtx;
+
+static bitecs_index_t bitecs_query_match(
+        bitecs_index_t cursor, const QueryCtx* ctx,
+        const bitecs_Entity* entts, bitecs_index_t count);
+
+static bitecs_index_t bitecs_query_miss(
+        bitecs_index_t cursor, const QueryCtx* ctx,
+        const bitecs_Entity* entts, bitecs_index_t count);
+
+// double-buffered: readers get chunk as of last swap, writer - own copy of it. 0 - OOM
+static index_t select_buffered(component_list* list, bool written, index_t begin, index_t count, bitecs_ptrs out)
+{
+    size_t chunk = begin >> components_shift(list);
+    if (written && unlikely(!chunk_diverge(list, chunk))) return 0;
+    Chunk* owner = written ? list->chunks[chunk] : list->prev[chunk];
+    assert(owner && "Attempt to select from NULL chunk (mask of component lies?)");
+    index_t i = begin & fill_up_to(components_shift(list));
+    *out = owner->storage + i * list->meta.typesize;
+    index_t chunkTail = components_in_chunk(list) - i;
+    return count > chunkTail ? chunkTail : count;
+}
+
+// writes: bit i - comps[i] is modified (components past 64 always are). 0 - OOM in forked registry
+// (or while copying double-buffered chunk)
+static index_t select_components(
+    bitecs_registry *reg, const int* comps, int ncomps, uint64_t writes,
+    index_t begin, index_t count, bitecs_ptrs out)
+{
+    index_t smallestRange = count;
+    for (int i = 0; i < ncomps; ++i) {
+        bool written = i >= 64 || ((writes >> i) & 1);
+        if (unlikely(reg->forked) && written && unlikely(!chunks_own(reg, comps[i], begin, 1))) return 0;
+        component_list* list = reg_list(reg, comps[i]);
+        index_t selected = unlikely(is_double_buffered(list))
+            ? select_buffered(list, written, begin, count, out++)
+            : select_up_to_chunk(list, begin, count, out++);
+        if (unlikely(!selected)) return 0;
+        smallestRange = selected < smallestRange ? selected : smallestRange;
+    }
+    return smallestRange;
+}
+
+// bit i: comps->components[i] is in writes (NULL - all of them)
+static uint64_t writes_mask(const bitecs_ComponentsList* comps, const bitecs_ComponentsList* writes)
+{
+    if (!writes) return ~(uint64_t)0;
+    uint64_t res = 0;
+    for (unsigned i = 0; i < comps->ncomps && i < 64; ++i) {
+        for (unsigned j = 0; j < writes->ncomps; ++j) {
+            if (comps->components[i] == writes->components[j]) res |= (uint64_t)1 << i;
+        }
+    }
+    return res;
+}
+
+bitecs_index_t bitecs_components_select(
+    bitecs_registry *reg, const int* comps, int ncomps,
+    bitecs_index_t begin, bitecs_index_t count, bitecs_ptrs out)
+{
+    return select_components(reg, comps, ncomps, ~(uint64_t)0, begin, count, out);
+}
+
+bitecs_index_t bitecs_components_select_writes(
+    bitecs_registry *reg, const int* comps, int ncomps, uint64_t writes,
+    bitecs_index_t begin, bitecs_index_t count, bitecs_ptrs out)
+{
+    return select_components(reg, comps, ncomps, writes, begin, count, out);
+}
+
+bitecs_Entity* bitecs_registry_entities(bitecs_registry *reg, bitecs_index_t *count)
+{
+    registry_mirror(reg);
+    // entts are writable (flags): forked registry gets own table first
+    if (unlikely(!entities_own(reg))) {
+        *count = 0;
+        return NULL;
+    }
+    *count = reg->entities_count;
+    return reg->entities;
+}
+
+static void step_init(StepCtx* ctx, const bitecs_ComponentsList* comps, bitecs_flags_t flags, bitecs_ptrs ptrs)
+{
+    *ctx = (StepCtx){0};
+    ctx->queryContext.flags = flags;
+    ctx->queryContext.query = comps->mask;
+    bitecs_ranks_get(&ctx->queryContext.ranks, ctx->queryContext.query.dict);
+    ctx->ptrStorage = ptrs;
+    ctx->components = comps->components;
+    ctx->ncomps = comps->ncomps;
+    ctx->writes = ~(uint64_t)0;
+}
+
+// next batch: entts [*outIndex; *outIndex + N), that lie contiguously in all chunks.
+// components are in ctx->ptrStorage. returns N (0 - done)
+static index_t bitecs_system_step(bitecs_registry *reg, StepCtx* ctx, index_t* outIndex)
+{
+    if (ctx->cursor == ctx->run_end) {
+        index_t offset = bitecs_query_match(ctx->cursor, &ctx->queryContext, ctx->begin, ctx->count);
+        if (unlikely(offset == ctx->count)) {
+            ctx->cursor = ctx->run_end = ctx->count;
+            return 0;
+        }
+        index_t limit = ctx->count;
+        if (ctx->window_shift) {
+            index_t windowEnd = (index_t)(offset | fill_up_to(ctx->window_shift)) + 1;
+            if (windowEnd > offset && windowEnd < limit) limit = windowEnd;
+        }
+        ctx->run_end = bitecs_query_miss(offset, &ctx->queryContext, ctx->begin, limit);
+        ctx->cursor = offset;
+    }
+    index_t selected = select_components(
+        reg, ctx->components, ctx->ncomps, ctx->writes,
+        ctx->cursor, ctx->run_end - ctx->cursor, ctx->ptrStorage);
+    *outIndex = ctx->cursor;
+    ctx->cursor += selected;
+#ifdef BITECS_PROFILE
+    ctx->matched += selected;
+    ctx->runs++;
+#endif
+    return selected;
+}
+
+void bitecs_system_run(bitecs_registry *reg, bitecs_SystemParams* params)
+{
+    if (unlikely(!params->comps->ncomps)) return;
+    registry_mirror(reg);
+    // system gets writable proxies (OOM in forked registry: not run)
+    if (unlikely(!entities_own(reg))) return;
+    StepCtx ctx;
+    void* ptrs[params->comps->ncomps];
+    step_init(&ctx, params->comps, params->flags, ptrs);
+    ctx.writes = writes_mask(params->comps, params->writes);
+    ctx.system = params->system;
+    ctx.udata = params->udata;
+    ctx.begin = reg->entities;
+    ctx.count = reg->entities_count;
+#ifdef BITECS_PROFILE
+    bitecs_SystemTrace trace = {0};
+    trace.name = params->name;
+    trace.begin_ns = bitecs_profile_now();
+#endif
+    bitecs_CallbackContext cb_ctx;
+    index_t selected;
+    while ((selected = bitecs_system_step(reg, &ctx, &cb_ctx.index))) {
+        cb_ctx.entts = (bitecs_EntityProxy*)ctx.begin + cb_ctx.index;
+        ctx.system(ctx.udata, &cb_ctx, ctx.ptrStorage, selected);
+    }
+#ifdef BITECS_PROFILE
+    trace.end_ns = bitecs_profile_now();
+    trace.scanned = ctx.count;
+    trace.matched = ctx.matched;
+    trace.runs = ctx.runs;
+    bitecs_profile_record(reg, &trace);
+#endif
+}
+
+struct bitecs_query
+{
+    bitecs_registry* reg;
+    StepCtx step;
+    void* ptrs[];
+};
+
+static size_t query_sizeof(const bitecs_query* query) {
+    return sizeof(bitecs_query) + sizeof(void*) * (size_t)query->step.ncomps;
+}
+
+bitecs_query* bitecs_query_begin(
+    bitecs_registry *reg, const bitecs_ComponentsList *comps, bitecs_flags_t flags, const bitecs_ComponentsList *writes)
+{
+    size_t size = sizeof(bitecs_query) + sizeof(void*) * comps->ncomps;
+    bitecs_query* query = mem_alloc(&reg->alloc, size, bitecs_alloc_temp);
+    if (unlikely(!query)) return NULL;
+    query->reg = reg;
+    registry_mirror(reg);
+    step_init(&query->step, comps, flags, query->ptrs);
+    query->step.writes = writes_mask(comps, writes);
+    return query;
+}
+
+// smallest chunk of comps: batches end on its boundaries anyway
+static int step_window_shift(bitecs_registry* reg, const StepCtx* ctx)
+{
+    int res = 0;
+    for (int i = 0; i < ctx->ncomps; ++i) {
+        component_list* list = reg_list(reg, ctx->components[i]);
+        if (!list || is_sparse(list)) continue;
+        int shift = components_shift(list);
+        res = !res || shift < res ? shift : res;
+    }
+    return res ? res : SPARSE_PAGE_SHIFT;
+}
+
+bool bitecs_query_next(bitecs_query *query, bitecs_QueryBatch *out)
+{
+    StepCtx* step = &query->step;
+    if (unlikely(!step->ncomps)) return false;
+    // entts may have been created (and table relocated), destroyed or changed since last call:
+    // re-match current run from cursor. Runs are matched up to end of chunk only, so rest of
+    // long run is not rescanned on every call
+    registry_mirror(query->reg);
+    if (unlikely(!entities_own(query->reg))) return false;
+    step->run_end = step->cursor;
+    step->window_shift = step_window_shift(query->reg, step);
+    step->begin = query->reg->entities;
+    step->count = query->reg->entities_count;
+    index_t count = bitecs_system_step(query->reg, step, &out->index);
+    if (!count) return false;
+    out->count = count;
+    out->entts = (bitecs_EntityProxy*)step->begin + out->index;
+    out->ptrs = query->ptrs;
+    return true;
+}
+
+void bitecs_query_end(bitecs_query *query)
+{
+    if (!query) return;
+    mem_free(&query->reg->alloc, query, query_sizeof(query), bitecs_alloc_temp);
+}
+
+struct bitecs_run
+{
+    bitecs_SystemParams params;
+    bitecs_query* query;
+};
+
+bitecs_run* bitecs_system_run_begin(bitecs_registry *reg, const bitecs_SystemParams *params)
+{
+    bitecs_run* run = mem_alloc(&reg->alloc, sizeof(bitecs_run), bitecs_alloc_temp);
+    if (unlikely(!run)) return NULL;
+    run->params = *params;
+    run->query = bitecs_query_begin(reg, params->comps, params->flags, params->writes);
+    if (unlikely(!run->query)) {
+        mem_free(&reg->alloc, run, sizeof(bitecs_run), bitecs_alloc_temp);
+        return NULL;
+    }
+    return run;
+}
+
+bool bitecs_system_run_resume(bitecs_run *run, bitecs_index_t max_entts, uint64_t max_ns)
+{
+    uint64_t deadline = max_ns ? bitecs_profile_now() + max_ns : 0;
+    index_t left = max_entts ? max_entts : (index_t)-1;
+    bool done = false;
+    bitecs_QueryBatch batch;
+    bitecs_CallbackContext cb_ctx;
+#ifdef BITECS_PROFILE
+    bitecs_SystemTrace trace = {0};
+    trace.name = run->params.name;
+    trace.begin_ns = bitecs_profile_now();
+    index_t from = run->query->step.cursor;
+#endif
+    while (left) {
+        if (!bitecs_query_next(run->query, &batch)) {
+            done = true;
+            break;
+        }
+        if (batch.count > left) {
+            // rest of batch goes to next slice
+            batch.count = left;
+            run->query->step.cursor = batch.index + left;
+        }
+        cb_ctx.index = batch.index;
+        cb_ctx.entts = batch.entts;
+        run->params.system(run->params.udata, &cb_ctx, batch.ptrs, batch.count);
+        left -= batch.count;
+#ifdef BITECS_PROFILE
+        trace.matched += batch.count;
+        trace.runs++;
+#endif
+        if (deadline && bitecs_profile_now() >= deadline) break;
+    }
+#ifdef BITECS_PROFILE
+    trace.end_ns = bitecs_profile_now();
+    trace.scanned = run->query->step.cursor - from;
+    bitecs_profile_record(run->query->reg, &trace);
+#endif
+    return done;
+}
+
+void bitecs_system_run_restart(bitecs_run *run)
+{
+    run->query->step.cursor = 0;
+    run->query->step.run_end = 0;
+}
+
+bitecs_index_t bitecs_system_run_cursor(bitecs_run *run)
+{
+    return run->query->step.cursor;
+}
+
+void bitecs_system_run_end(bitecs_run *run)
+{
+    if (!run) return;
+    bitecs_registry* reg = run->query->reg;
+    bitecs_query_end(run->query);
+    mem_free(&reg->alloc, run, sizeof(bitecs_run), bitecs_alloc_temp);
+}
+
+// profiling
+
+static _Thread_local int current_worker = 0;
+
+uint64_t bitecs_profile_now(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool bitecs_profile_enable(bitecs_registry *reg, size_t capacity)
+{
+    bitecs_SystemTrace* traces = NULL;
+    if (capacity) {
+        traces = mem_alloc(&reg->alloc, sizeof(bitecs_SystemTrace) * capacity, bitecs_alloc_temp);
+        if (unlikely(!traces)) return false;
+    }
+    mem_free(&reg->alloc, reg->traces, sizeof(bitecs_SystemTrace) * reg->traces_cap, bitecs_alloc_temp);
+    reg->traces = traces;
+    reg->traces_cap = capacity;
+    atomic_store(&reg->traces_head, 0);
+    return true;
+}
+
+void bitecs_profile_record(bitecs_registry *reg, const bitecs_SystemTrace *trace)
+{
+    if (!reg->traces_cap) return;
+    size_t head = atomic_fetch_add_explicit(&reg->traces_head, 1, memory_order_relaxed);
+    bitecs_SystemTrace* slot = reg->traces + head % reg->traces_cap;
+    *slot = *trace;
+    slot->worker = current_worker;
+}
+
+size_t bitecs_profile_read(bitecs_registry *reg, bitecs_SystemTrace *out, size_t max)
+{
+    size_t head = atomic_load(&reg->traces_head);
+    size_t count = head < reg->traces_cap ? head : reg->traces_cap;
+    count = count < max ? count : max;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = reg->traces[(head - count + i) % reg->traces_cap];
+    }
+    return count;
+}
+
+void bitecs_profile_clear(bitecs_registry *reg)
+{
+    atomic_store(&reg->traces_head, 0);
+}
+
+static void write_json_string(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') fputc('\\', file);
+        if ((unsigned char)*str >= 0x20) fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+bool bitecs_profile_export_chrome(bitecs_registry *reg, const char *path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+    size_t head = atomic_load(&reg->traces_head);
+    size_t count = head < reg->traces_cap ? head : reg->traces_cap;
+    fputs("{\"traceEvents\":[", file);
+    for (size_t i = 0; i < count; ++i) {
+        const bitecs_SystemTrace* trace = reg->traces + (head - count + i) % reg->traces_cap;
+        double avgBatch = trace->runs ? (double)trace->matched / trace->runs : 0;
+        fputs(i ? ",\n{\"name\":" : "\n{\"name\":", file);
+        write_json_string(file, trace->name ? trace->name : "system");
+        fprintf(file,
+            ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"scanned\":%lu,\"matched\":%lu,\"runs\":%lu,\"avg_batch\":%.2f}}",
+            trace->worker, trace->begin_ns / 1000.0, (trace->end_ns - trace->begin_ns) / 1000.0,
+            (unsigned long)trace->scanned, (unsigned long)trace->matched,
+            (unsigned long)trace->runs, avgBatch);
+    }
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
+
+static Entity* deref(bitecs_registry* reg, bitecs_EntityPtr ptr)
+{
+    return ptr.index < reg->entities_count && reg->entities[ptr.index].generation == ptr.generation
+        ? reg->entities + ptr.index
+        : NULL;
+}
+
+static bool reserve_chunks(component_list* list, index_t index, index_t count)
+{
+    if (unlikely(!list->meta.typesize || is_sparse(list))) return true;
+    index_t maxIndex = index + count;
+    index_t chunk = maxIndex >> components_shift(list);
+    if (list->nchunks <= chunk) {
+        index_t newSize = chunk + 1;
+        Chunk** newChunks = mem_alloc(list->alloc, sizeof(Chunk*) * newSize, bitecs_alloc_index);
+        if (!newChunks) return false;
+        if (is_double_buffered(list)) {
+            Chunk** newPrev = mem_alloc(list->alloc, sizeof(Chunk*) * newSize, bitecs_alloc_index);
+            if (unlikely(!newPrev)) {
+                mem_free(list->alloc, newChunks, sizeof(Chunk*) * newSize, bitecs_alloc_index);
+                return false;
+            }
+            if (list->prev) {
+                memcpy(newPrev, list->prev, sizeof(Chunk*) * list->nchunks);
+                mem_free(list->alloc, list->prev, sizeof(Chunk*) * list->nchunks, bitecs_alloc_index);
+            }
+            memset(newPrev + list->nchunks, 0, sizeof(Chunk*) * (newSize - list->nchunks));
+            list->prev = newPrev;
+        }
+        if (list->chunks) {
+            memcpy(newChunks, list->chunks, sizeof(Chunk*) * list->nchunks);
+            mem_free(list->alloc, list->chunks, sizeof(Chunk*) * list->nchunks, bitecs_alloc_index);
+        }
+        memset(newChunks + list->nchunks, 0, sizeof(Chunk*) * (newSize - list->nchunks));
+        list->chunks = newChunks;
+        list->nchunks = newSize;
+    }
+    return true;
+}
+
+// how many of [index; index + count) fit into one chunk
+static index_t chunk_tail(component_list* list, index_t index, index_t count)
+{
+    if (unlikely(!list->meta.typesize || is_sparse(list))) return count;
+    index_t tail = components_in_chunk(list) - (index & fill_up_to(components_shift(list)));
+    return tail < count ? tail : count;
+}
+
+static bool component_add_range(component_list* list, index_t index, index_t count, bitecs_ptrs begin, index_t* added)
+{
+    if (unlikely(!count)) return false;
+    if (unlikely(!list->meta.typesize)) {
+        *begin = NULL;
+        *added = count;
+        list->nalives += count;
+        return true;
+    }
+    if (unlikely(is_sparse(list))) {
+        bool ok = sparse_add_range(list, index, count, begin);
+        *added = ok ? count : 0;
+        list->nalives += *added;
+        return ok;
+    }
+    index_t chunk = index >> components_shift(list);
+    index_t i = index & fill_up_to(components_shift(list));
+    index_t diff = components_in_chunk(list) - i;
+    diff = diff > count ? count : diff;
+    Chunk* owner = list->chunks[chunk];
+    if (unlikely(!owner)) {
+        owner = chunk_new(list);
+        if (unlikely(!owner)) {
+            *begin = NULL;
+            *added = 0;
+            return false;
+        }
+    }
+    list->chunks[chunk] = owner;
+    if (unlikely(is_double_buffered(list))) {
+        if (!list->prev[chunk]) {
+            list->prev[chunk] = owner;
+        } else if (list->prev[chunk] != owner && unlikely(!added_push(list, index, diff))) {
+            *begin = NULL;
+            *added = 0;
+            return false;
+        }
+    }
+    owner->header.nalives += diff;
+    list->nalives += diff;
+    *begin = owner->storage + i * list->meta.typesize;
+    *added = diff;
+    return true;
+}
+
+void *bitecs_entt_add_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
+{
+    component_list* list = reg_list_use(reg, id);
+    if (!list) return NULL;
+    if (unlikely(!registry_own(reg, &id, 1, ptr.index, 1))) return NULL;
+    Entity* e = deref(reg, ptr);
+    if (!e) return NULL;
+    mask_t wasDict = e->dict;
+    mask_t wasComponents = e->components;
+    { //try to add to bitmask
+        if (!bitecs_mask_set((SparseMask*)e, id, true)) return NULL;
+        if (wasComponents == e->components) return NULL;
+    }
+    void* begin = NULL;
+    index_t added;
+    if (likely(reserve_chunks(list, ptr.index, 1))) {
+        // no need to check here! begin wont get reassigned
+        (void)component_add_range(list, ptr.index, 1, &begin, &added);
+        reg->mirror_pending |= list->nadded != 0;
+    }
+    if (unlikely(!begin)) {
+        e->dict = wasDict;
+        e->components = wasComponents;
+    }
+    return begin;
+}
+
+static void* deref_comp(component_list* list, index_t index)
+{
+    if (unlikely(is_sparse(list))) {
+        return sparse_at(list, sparse_slot(list, index));
+    }
+    index_t chunk = index >> components_shift(list);
+    index_t i = index & fill_up_to(components_shift(list));
+    Chunk* owner = list->chunks[chunk];
+    return owner->storage + list->meta.typesize * i;
+}
+
+// forget components of entts [index; index + count) (destruct: call deleter, else they were relocated out).
+// returns true if some chunk is now empty
+static bool component_erase_range(component_list* list, index_t index, index_t count, bool destruct)
+{
+    bool emptied = false;
+    list->nalives -= count;
+    if (unlikely(!list->meta.typesize)) return false;
+    while (count) {
+        void* begin;
+        index_t selected = select_up_to_chunk(list, index, count, &begin);
+        if (destruct && list->meta.deleter) {
+            list->meta.deleter(begin, selected);
+        }
+        if (unlikely(is_sparse(list))) {
+            sparse_erase(list, sparse_slot(list, index), selected);
+        } else {
+            Chunk* owner = list->chunks[index >> components_shift(list)];
+            owner->header.nalives -= selected;
+            emptied |= !owner->header.nalives;
+        }
+        index += selected;
+        count -= selected;
+    }
+    return emptied;
+}
+
+static bool component_remove_range(component_list* list, index_t index, index_t count)
+{
+    return component_erase_range(list, index, count, true);
+}
+
+// before component of entt at index is modified in place (entt must have it)
+static bool component_writable(bitecs_registry* reg, bitecs_comp_id_t id, index_t index)
+{
+    if (unlikely(!chunks_own(reg, id, index, 1))) return false;
+    component_list* list = reg_list(reg, id);
+    return likely(!is_double_buffered(list)) || chunk_diverge(list, index >> components_shift(list));
+}
+
+void *bitecs_entt_get_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
+{
+    Entity* e = deref(reg, ptr);
+    if (!e || !bitecs_mask_get((SparseMask*)e, id)) return NULL;
+    if (unlikely(!component_writable(reg, id, ptr.index))) return NULL;
+    return deref_comp(reg_list(reg, id), ptr.index);
+}
+
+const void *bitecs_entt_read_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
+{
+    Entity* e = deref(reg, ptr);
+    if (!e || !bitecs_mask_get((SparseMask*)e, id)) return NULL;
+    component_list* list = reg_list(reg, id);
+    if (likely(!is_double_buffered(list))) return deref_comp(list, ptr.index);
+    registry_mirror(reg);
+    Chunk* owner = list->prev[ptr.index >> components_shift(list)];
+    return owner->storage + list->meta.typesize * (ptr.index & fill_up_to(components_shift(list)));
+}
+
+void bitecs_component_swap(bitecs_registry *reg, bitecs_comp_id_t id)
+{
+    component_list* list = reg_list(reg, id);
+    if (!list || !is_double_buffered(list)) return;
+    for (size_t chunk = 0; chunk < list->nchunks; ++chunk) {
+        chunk_settle(list, chunk);
+    }
+    list->nadded = 0;
+}
+
+// batched access
+
+typedef enum {
+    batch_get,
+    batch_gather,
+    batch_scatter,
+} BatchMode;
+
+#define BATCH_PREFETCH 8
+#define BATCH_SORT_MIN 1024
+#define BATCH_MAX_BUCKETS_SHIFT 16
+
+// storage of one component type, hoisted out of per handle loop
+typedef struct {
+    component_list* list;
+    bitecs_comp_id_t id;
+    int group;
+    dict_t group_bit;
+    dict_t below_group;
+    int bit;
+    int shift;
+    size_t typesize;
+    bool sparse;
+} BatchCtx;
+
+typedef struct {
+    bitecs_EntityPtr ptr;
+    size_t pos;
+} BatchItem;
+
+static char empty_component;
+
+static void* resolve_comp(bitecs_registry* reg, const BatchCtx* ctx, bitecs_EntityPtr ptr)
+{
+    if (unlikely(ptr.index >= reg->entities_count)) return NULL;
+    const Entity* e = reg->entities + ptr.index;
+    if (e->generation != ptr.generation || e->dict == dead_entt) return NULL;
+    if (!(e->dict & ctx->group_bit)) return NULL;
+    int groupIndex = dict_popcnt(e->dict & ctx->below_group);
+    if (!((e->components >> (groupIndex * BITECS_GROUP_SIZE + ctx->bit)) & 1)) return NULL;
+    if (unlikely(!ctx->typesize)) return &empty_component;
+    if (unlikely(ctx->sparse)) return sparse_at(ctx->list, sparse_slot(ctx->list, ptr.index));
+    Chunk* owner = ctx->list->chunks[ptr.index >> ctx->shift];
+    return owner->storage + ctx->typesize * (ptr.index & fill_up_to(ctx->shift));
+}
+
+static void prefetch_comp(bitecs_registry* reg, const BatchCtx* ctx, index_t index)
+{
+    if (unlikely(index >= reg->entities_count)) return;
+    __builtin_prefetch(reg->entities + index);
+    if (ctx->sparse || !ctx->typesize) return;
+    index_t chunk = index >> ctx->shift;
+    if (chunk >= ctx->list->nchunks || !ctx->list->chunks[chunk]) return;
+    __builtin_prefetch(ctx->list->chunks[chunk]->storage + ctx->typesize * (index & fill_up_to(ctx->shift)));
+}
+
+// constant sizes -> inlined copies for small components
+static void copy_comp(void* restrict into, const void* restrict from, size_t typesize)
+{
+    switch (typesize) {
+    case 4: memcpy(into, from, 4); break;
+    case 8: memcpy(into, from, 8); break;
+    case 12: memcpy(into, from, 12); break;
+    case 16: memcpy(into, from, 16); break;
+    default: memcpy(into, from, typesize); break;
+    }
+}
+
+static void batch_one(BatchMode mode, const BatchCtx* ctx, void* comp, size_t pos, void** ptrsOut, char* buff)
+{
+    switch (mode) {
+    case batch_get: ptrsOut[pos] = comp; break;
+    case batch_gather: if (comp) copy_comp(buff + pos * ctx->typesize, comp, ctx->typesize); break;
+    case batch_scatter: if (comp) copy_comp(comp, buff + pos * ctx->typesize, ctx->typesize); break;
+    }
+}
+
+// handles are visited chunk by chunk (counting sort) -> entity table and chunks are walked forward,
+// each chunk stays in cache while its handles are resolved. Prefetch is issued BATCH_PREFETCH handles ahead
+static index_t do_batch(
+    bitecs_registry* reg, bitecs_comp_id_t id, const bitecs_EntityPtr* ptrs, size_t nptrs,
+    BatchMode mode, void** ptrsOut, char* buff)
+{
+    component_list* list = reg_list(reg, id);
+    if (unlikely(!list)) {
+        if (mode == batch_get) memset(ptrsOut, 0, sizeof(void*) * nptrs);
+        return 0;
+    }
+    BatchCtx ctx;
+    ctx.list = list;
+    ctx.id = id;
+    ctx.group = id >> BITECS_GROUP_SHIFT;
+    ctx.group_bit = (dict_t)1 << ctx.group;
+    ctx.below_group = fill_up_to(ctx.group);
+    ctx.bit = id & fill_up_to(BITECS_GROUP_SHIFT);
+    ctx.shift = components_shift(list);
+    ctx.typesize = list->meta.typesize;
+    ctx.sparse = is_sparse(list);
+    if ((unlikely(reg->forked) || unlikely(is_double_buffered(list))) && mode != batch_gather) {
+        for (size_t i = 0; i < nptrs; ++i) {
+            if (!resolve_comp(reg, &ctx, ptrs[i]) || component_writable(reg, id, ptrs[i].index)) continue;
+            if (mode == batch_get) memset(ptrsOut, 0, sizeof(void*) * nptrs);
+            return 0;
+        }
+    }
+    index_t found = 0;
+    BatchItem* order = NULL;
+    size_t* offsets = NULL;
+    index_t maxIndex = 0;
+    for (size_t i = 0; i < nptrs; ++i) {
+        maxIndex = ptrs[i].index > maxIndex ? ptrs[i].index : maxIndex;
+    }
+    // bucket = chunk (or group of chunks, if there are too many of them)
+    int bucketShift = ctx.shift;
+    int indexBits = maxIndex ? (int)(sizeof(unsigned long long) * CHAR_BIT) - __builtin_clzll(maxIndex) : 0;
+    if (indexBits - bucketShift > BATCH_MAX_BUCKETS_SHIFT) bucketShift = indexBits - BATCH_MAX_BUCKETS_SHIFT;
+    size_t nbuckets = ((size_t)maxIndex >> bucketShift) + 1;
+    if (nptrs >= BATCH_SORT_MIN && nbuckets > 1) {
+        order = mem_alloc(&reg->alloc, sizeof(BatchItem) * nptrs, bitecs_alloc_temp);
+        offsets = mem_alloc(&reg->alloc, sizeof(size_t) * nbuckets, bitecs_alloc_temp);
+    }
+    if (!order || !offsets) {
+        mem_free(&reg->alloc, order, sizeof(BatchItem) * nptrs, bitecs_alloc_temp);
+        mem_free(&reg->alloc, offsets, sizeof(size_t) * nbuckets, bitecs_alloc_temp);
+        for (size_t i = 0; i < nptrs; ++i) {
+            if (i + BATCH_PREFETCH < nptrs) prefetch_comp(reg, &ctx, ptrs[i + BATCH_PREFETCH].index);
+            void* comp = resolve_comp(reg, &ctx, ptrs[i]);
+            found += comp != NULL;
+            batch_one(mode, &ctx, comp, i, ptrsOut, buff);
+        }
+        return found;
+    }
+    // counting sort by bucket
+    memset(offsets, 0, sizeof(size_t) * nbuckets);
+    for (size_t i = 0; i < nptrs; ++i) {
+        offsets[ptrs[i].index >> bucketShift]++;
+    }
+    size_t sum = 0;
+    for (size_t b = 0; b < nbuckets; ++b) {
+        size_t n = offsets[b];
+        offsets[b] = sum;
+        sum += n;
+    }
+    for (size_t i = 0; i < nptrs; ++i) {
+        BatchItem* into = order + offsets[ptrs[i].index >> bucketShift]++;
+        into->ptr = ptrs[i];
+        into->pos = i;
+    }
+    mem_free(&reg->alloc, offsets, sizeof(size_t) * nbuckets, bitecs_alloc_temp);
+    for (size_t i = 0; i < nptrs; ++i) {
+        if (i + BATCH_PREFETCH < nptrs) prefetch_comp(reg, &ctx, order[i + BATCH_PREFETCH].ptr.index);
+        void* comp = resolve_comp(reg, &ctx, order[i].ptr);
+        found += comp != NULL;
+        batch_one(mode, &ctx, comp, order[i].pos, ptrsOut, buff);
+    }
+    mem_free(&reg->alloc, order, sizeof(BatchItem) * nptrs, bitecs_alloc_temp);
+    return found;
+}
+
+bitecs_index_t bitecs_components_get_batch(
+    bitecs_registry *reg, bitecs_comp_id_t id, const bitecs_EntityPtr *ptrs, size_t nptrs, void **out)
+{
+    return do_batch(reg, id, ptrs, nptrs, batch_get, out, NULL);
+}
+
+bitecs_index_t bitecs_components_gather(
+    bitecs_registry *reg, bitecs_comp_id_t id, const bitecs_EntityPtr *ptrs, size_t nptrs, void *out)
+{
+    return do_batch(reg, id, ptrs, nptrs, batch_gather, NULL, out);
+}
+
+bitecs_index_t bitecs_components_scatter(
+    bitecs_registry *reg, bitecs_comp_id_t id, const bitecs_EntityPtr *ptrs, size_t nptrs, const void *in)
+{
+    return do_batch(reg, id, ptrs, nptrs, batch_scatter, NULL, (char*)in);
+}
+
+bool bitecs_entt_remove_component(bitecs_registry *reg, bitecs_EntityPtr ptr, bitecs_comp_id_t id)
+{
+    if (unlikely(!registry_own(reg, &id, 1, ptr.index, 1))) return false;
+    Entity* e = deref(reg, ptr);
     if (unlikely(!e)) return false;
     if (!bitecs_mask_get((SparseMask*)e, id)) return false;
-    component_list* list = reg->components[id];
-    index_t chunk = ptr.index >> components_shift(list);
-    index_t i = ptr.index & fill_up_to(components_shift(list));
-    Chunk* owner = list->chunks[chunk];
-    void* comp = owner->storage + i * list->meta.typesize;
-    if (list->meta.deleter) {
-        list->meta.deleter(comp, 1);
-    }
-    if (owner->header.nalives-- == 1) {
+    component_list* list = reg_list(reg, id);
+    if (component_remove_range(list, ptr.index, 1)) {
         atomic_store_explicit(&reg->chunks_cleanup_pending, true, memory_order_relaxed);
     }
     return bitecs_mask_set((SparseMask*)e, id, false);
@@ -408,11 +2375,11 @@ static bool reserve_entts(bitecs_registry *reg, index_t count)
     if (count > reg->entities_cap) {
         index_t newCap = reg->entities_cap * 1.7;
         if (newCap < count) newCap = count;
-        Entity* newEnts = malloc(sizeof(Entity) * newCap);
+        Entity* newEnts = mem_alloc(&reg->alloc, sizeof(Entity) * newCap, bitecs_alloc_entities);
         if (unlikely(!newEnts)) return false;
         if (reg->entities) {
             memcpy(newEnts, reg->entities, sizeof(Entity) * reg->entities_count);
-            free(reg->entities);
+            mem_free(&reg->alloc, reg->entities, sizeof(Entity) * reg->entities_cap, bitecs_alloc_entities);
         }
         reg->entities = newEnts;
         reg->entities_cap = newCap;
@@ -426,8 +2393,12 @@ bool bitecs_entt_create(
     bitecs_Callback creator, void* udata)
 {
     if (unlikely(!count)) return true;
+    if (unlikely(!entities_own(reg))) return false;
     index_t found;
-    if (!take_free(&reg->freeList, count, &found)) {
+    bool taken = reg->placement == bitecs_placement_archetype
+        ? take_free_near(reg, &components->mask, count, &found)
+        : take_free(&reg->alloc, &reg->freeList, count, &found);
+    if (!taken) {
         // prevent always allocating cases (high fragmentation of free spaces)
         // when total free slots is 3 times the wanted count, but could not fit -> split
         // wanted chunks by 2
@@ -445,10 +2416,11 @@ bool bitecs_entt_create(
     }
     for (unsigned i = 0; i < components->ncomps; ++i) {
         int comp = components->components[i];
-        component_list* list = reg->components[comp];
+        component_list* list = reg_list_use(reg, comp);
         if (unlikely(!list)) return false;
         if (unlikely(!reserve_chunks(list, found, count))) return false;
     }
+    if (unlikely(!registry_own(reg, components->components, components->ncomps, found, count))) return false;
     for (index_t i = found; i < found + count; ++i) {
         reg->entities[i].components = components->mask.bits;
         reg->entities[i].dict = components->mask.dict;
@@ -458,197 +2430,827 @@ bool bitecs_entt_create(
     index_t cursor = found;
     void* begins[components->ncomps];
     bitecs_CallbackContext cb_ctx;
+    if (found + count > reg->entities_count) {
+        reg->entities_count = found + count;
+    }
     while (count) {
         index_t smallestRange = count;
+        for (unsigned i = 0; i < components->ncomps; ++i) {
+            component_list* list = reg_list(reg, components->components[i]);
+            index_t tail = chunk_tail(list, cursor, count);
+            smallestRange = tail < smallestRange ? tail : smallestRange;
+        }
         for (unsigned i = 0; i < components->ncomps; ++i) {
             int comp = components->components[i];
-            component_list* list = reg->components[comp];
+            component_list* list = reg_list(reg, comp);
             index_t added;
-            bool ok = component_add_range(list, cursor, count, begins + i, &added);
+            bool ok = component_add_range(list, cursor, smallestRange, begins + i, &added);
             if (unlikely(!ok)) return false; // already created leak here?
-            smallestRange = added < smallestRange ? added : smallestRange;
         }
         cb_ctx.entts = (bitecs_EntityProxy*)reg->entities + cursor;
         cb_ctx.index = cursor;
         creator(udata, &cb_ctx, begins, smallestRange);
         count -= smallestRange;
         cursor += smallestRange;
-        reg->entities_count += smallestRange;
     }
+    for (unsigned i = 0; i < components->ncomps; ++i) {
+        component_list* list = reg_list(reg, components->components[i]);
+        if (unlikely(list->nadded)) mirror_added(list);
+    }
+    return true;
+}
+
+// components of last seen archetype. Reused while destroying runs of same archetype
+typedef struct {
+    dict_t dict;
+    mask_t mask;
+    int ncomps;
+    bitecs_BitsStorage comps;
+} ArchetypeComps;
+
+static void archetype_comps(ArchetypeComps* cache, const Entity* e)
+{
+    if (cache->dict == e->dict && cache->mask == e->components) return;
+    Ranks ranks;
+    bitecs_ranks_get(&ranks, e->dict);
+    cache->ncomps = bitecs_mask_into_array((const SparseMask*)e, &ranks, cache->comps);
+    cache->dict = e->dict;
+    cache->mask = e->components;
+}
+
+// [begin; begin + count) must be alive. false: OOM in forked registry (entts stay alive).
+// hint: see add_free()
+static bool destroy_range(
+    bitecs_registry *reg, ArchetypeComps* cache, FreeList** hint, index_t begin, index_t count, bool destruct)
+{
+    bool emptied = false;
+    index_t end = begin + count;
+    if (unlikely(reg->forked)) {
+        for (index_t i = begin; i < end; ++i) {
+            archetype_comps(cache, reg->entities + i);
+            if (unlikely(!registry_own(reg, cache->comps, cache->ncomps, i, 1))) return false;
+        }
+    }
+    index_t run = begin;
+    while (run < end) {
+        const Entity* first = reg->entities + run;
+        index_t runEnd = run + 1;
+        while (runEnd < end
+               && reg->entities[runEnd].dict == first->dict
+               && reg->entities[runEnd].components == first->components) {
+            runEnd++;
+        }
+        archetype_comps(cache, first);
+        for (int ci = 0; ci < cache->ncomps; ++ci) {
+            component_list* list = reg_list(reg, cache->comps[ci]);
+            assert(list && "Attempt to delete entt with nonexistend component");
+            emptied |= component_erase_range(list, run, runEnd - run, destruct);
+        }
+        run = runEnd;
+    }
+    for (index_t i = begin; i < end; ++i) {
+        Entity* e = reg->entities + i;
+        assert(e->dict != dead_entt);
+        e->generation = reg->generation;
+        e->dict = dead_entt;
+    }
+    if (emptied) {
+        atomic_store_explicit(&reg->chunks_cleanup_pending, true, memory_order_relaxed);
+    }
+    if (likely(add_free(&reg->alloc, &reg->freeList, hint, begin, count))) {
+        reg->total_free += count;
+    }
+    return true;
+}
+
+static bool do_destroy_batch(bitecs_registry *reg, ArchetypeComps* cache, FreeList** hint, index_t begin, index_t count)
+{
+    return destroy_range(reg, cache, hint, begin, count, true);
+}
+
+// LSD radix sort by index, 8 bits per pass. Passes above highest bit or with all digits same are skipped.
+// Max index is found upfront: one scan instead of counting pass per high byte, that is zero anyway
+static bitecs_EntityPtr* sort_by_index(bitecs_EntityPtr* ptrs, bitecs_EntityPtr* tmp, size_t count)
+{
+    index_t maxIndex = 0;
+    for (size_t i = 0; i < count; ++i) {
+        maxIndex = ptrs[i].index > maxIndex ? ptrs[i].index : maxIndex;
+    }
+    for (unsigned shift = 0; shift < sizeof(index_t) * CHAR_BIT && (maxIndex >> shift); shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < count; ++i) {
+            offsets[(ptrs[i].index >> shift) & 0xFF]++;
+        }
+        if (offsets[(ptrs[0].index >> shift) & 0xFF] == count) continue;
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t n = offsets[d];
+            offsets[d] = sum;
+            sum += n;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            tmp[offsets[(ptrs[i].index >> shift) & 0xFF]++] = ptrs[i];
+        }
+        bitecs_EntityPtr* swap = ptrs;
+        ptrs = tmp;
+        tmp = swap;
+    }
+    return ptrs;
+}
+
+#define DESTROY_STACK_PTRS 64
+
+void bitecs_entt_destroy_batch(bitecs_registry *reg, const bitecs_EntityPtr *ptrs, size_t nptrs)
+{
+    if (unlikely(!nptrs)) return;
+    bitecs_EntityPtr stackBuff[DESTROY_STACK_PTRS * 2];
+    bitecs_EntityPtr* buff = stackBuff;
+    if (nptrs > DESTROY_STACK_PTRS) {
+        buff = mem_alloc(&reg->alloc, sizeof(bitecs_EntityPtr) * nptrs * 2, bitecs_alloc_temp);
+        if (unlikely(!buff)) {
+            for (size_t i = 0; i < nptrs; ++i) {
+                bitecs_entt_destroy(reg, ptrs[i]);
+            }
+            return;
+        }
+    }
+    memcpy(buff, ptrs, sizeof(bitecs_EntityPtr) * nptrs);
+    const bitecs_EntityPtr* sorted = sort_by_index(buff, buff + nptrs, nptrs);
+    reg->generation++;
+    ArchetypeComps cache;
+    cache.dict = dead_entt;
+    cache.mask = 0;
+    // runs come in ascending order: merged into free list in one pass
+    FreeList* hint = NULL;
+    index_t begin = 0;
+    index_t count = 0;
+    for (size_t i = 0; i < nptrs; ++i) {
+        bitecs_EntityPtr ptr = sorted[i];
+        if (count && ptr.index == begin + count - 1) continue; // duplicate
+        if (!deref(reg, ptr)) continue; // stale
+        if (count && ptr.index == begin + count) {
+            count++;
+            continue;
+        }
+        if (count) {
+            (void)do_destroy_batch(reg, &cache, &hint, begin, count);
+        }
+        begin = ptr.index;
+        count = 1;
+    }
+    if (count) {
+        (void)do_destroy_batch(reg, &cache, &hint, begin, count);
+    }
+    if (buff != stackBuff) {
+        mem_free(&reg->alloc, buff, sizeof(bitecs_EntityPtr) * nptrs * 2, bitecs_alloc_temp);
+    }
+}
+
+void bitecs_entt_destroy(bitecs_registry *reg, bitecs_EntityPtr ptr)
+{
+    Entity* e = deref(reg, ptr);
+    if (unlikely(!e)) return;
+    reg->generation++;
+    ArchetypeComps cache;
+    cache.dict = dead_entt;
+    cache.mask = 0;
+    (void)do_destroy_batch(reg, &cache, NULL, ptr.index, 1);
+}
+
+bitecs_index_t bitecs_entt_destroy_matching(
+    bitecs_registry *reg, const bitecs_ComponentsList *comps, bitecs_flags_t flags)
+{
+    QueryCtx query = {0};
+    query.flags = flags;
+    query.query = comps->mask;
+    bitecs_ranks_get(&query.ranks, query.query.dict);
+    reg->generation++;
+    ArchetypeComps cache;
+    cache.dict = dead_entt;
+    cache.mask = 0;
+    // runs are found in ascending order: merged into free list in one pass
+    FreeList* hint = NULL;
+    index_t destroyed = 0;
+    index_t cursor = 0;
+    index_t count = reg->entities_count;
+    while (cursor < count) {
+        index_t begin = bitecs_query_match(cursor, &query, reg->entities, count);
+        if (begin == count) break;
+        index_t end = bitecs_query_miss(begin, &query, reg->entities, count);
+        if (unlikely(!do_destroy_batch(reg, &cache, &hint, begin, end - begin))) break;
+        destroyed += end - begin;
+        cursor = end;
+    }
+    return destroyed;
+}
+
+// transfer between registries
+
+typedef struct {
+    bitecs_registry* src;
+    const int* comps;
+    int ncomps;
+    // next src entt to move
+    index_t from;
+    // new handles of moved entts (may be NULL)
+    bitecs_EntityPtr* out;
+} TransferCtx;
+
+static void transfer_creator(bitecs_udata udata, bitecs_CallbackContext* ctx, bitecs_ptrs begins, index_t count)
+{
+    TransferCtx* transfer = udata;
+    for (int i = 0; i < transfer->ncomps; ++i) {
+        component_list* list = reg_list(transfer->src, transfer->comps[i]);
+        if (!list->meta.typesize) continue;
+        char* into = begins[i];
+        index_t done = 0;
+        while (done < count) {
+            void* from;
+            index_t selected = select_up_to_chunk(list, transfer->from + done, count - done, &from);
+            relocate(list, from, selected, into + (size_t)done * list->meta.typesize);
+            done += selected;
+        }
+    }
+    Entity* created = (Entity*)ctx->entts;
+    for (index_t i = 0; i < count; ++i) {
+        created[i].flags = transfer->src->entities[transfer->from + i].flags;
+        if (transfer->out) {
+            *transfer->out++ = (bitecs_EntityPtr){created[i].generation, ctx->index + i};
+        }
+    }
+    transfer->from += count;
+}
+
+size_t bitecs_entt_transfer(
+    bitecs_registry *src, bitecs_registry *dst, const bitecs_EntityPtr *ptrs, size_t nptrs, bitecs_EntityPtr *out)
+{
+    if (unlikely(src == dst)) return 0;
+    src->generation++;
+    ArchetypeComps cache;
+    cache.dict = dead_entt;
+    cache.mask = 0;
+    size_t moved = 0;
+    size_t i = 0;
+    while (i < nptrs) {
+        const Entity* e = deref(src, ptrs[i]);
+        size_t next = i + 1;
+        bool ok = e != NULL;
+        if (ok) {
+            // run of same archetype in src -> one bitecs_entt_create() in dst
+            SparseMask mask = {e->dict, e->components};
+            while (next < nptrs && ptrs[next].index == ptrs[next - 1].index + 1) {
+                const Entity* other = deref(src, ptrs[next]);
+                if (!other || other->dict != mask.dict || other->components != mask.bits) break;
+                next++;
+            }
+            index_t count = (index_t)(next - i);
+            archetype_comps(&cache, e);
+            for (int ci = 0; ci < cache.ncomps; ++ci) {
+                ok &= reg_list_use(dst, cache.comps[ci]) != NULL;
+            }
+            ok = ok && registry_own(src, cache.comps, cache.ncomps, ptrs[i].index, count);
+            if (ok) {
+                bitecs_ComponentsList list = {mask, cache.comps, (unsigned)cache.ncomps};
+                TransferCtx ctx = {src, cache.comps, cache.ncomps, ptrs[i].index, out ? out + i : NULL};
+                ok = bitecs_entt_create(dst, count, &list, transfer_creator, &ctx);
+                // OOM in dst: part of run may be moved already
+                index_t relocated = ctx.from - ptrs[i].index;
+                if (relocated) {
+                    (void)destroy_range(src, &cache, NULL, ptrs[i].index, relocated, false);
+                    moved += relocated;
+                    i += relocated;
+                }
+            }
+        }
+        for (; !ok && out && i < next; ++i) {
+            out[i] = (bitecs_EntityPtr){0, (index_t)-1};
+        }
+        i = next;
+    }
+    return moved;
+}
+
+// prefab instantiation
+
+typedef struct {
+    bitecs_registry* reg;
+    index_t prefab;
+    const int* comps;
+    int ncomps;
+    // handles of created entts (may be NULL)
+    bitecs_EntityPtr* out;
+} InstantiateCtx;
+
+// copy construct count copies of value into raw storage: one copy, then filled prefix is doubled
+static void fill_copies(component_list* list, const void* value, char* into, index_t count)
+{
+    size_t typesize = list->meta.typesize;
+    index_t filled = 0;
+    while (filled < count) {
+        const void* from = filled ? into : value;
+        index_t n = filled ? filled : 1;
+        n = n < count - filled ? n : count - filled;
+        if (list->meta.copier) {
+            list->meta.copier(from, n, into + (size_t)filled * typesize);
+        } else {
+            memcpy(into + (size_t)filled * typesize, from, (size_t)n * typesize);
+        }
+        filled += n;
+    }
+}
+
+static void instantiate_creator(bitecs_udata udata, bitecs_CallbackContext* ctx, bitecs_ptrs begins, index_t count)
+{
+    InstantiateCtx* inst = udata;
+    for (int i = 0; i < inst->ncomps; ++i) {
+        component_list* list = reg_list(inst->reg, inst->comps[i]);
+        if (!list->meta.typesize) continue;
+        // resolved per span: sparse storage (or forked chunk) of prefab may have moved
+        fill_copies(list, deref_comp(list, inst->prefab), begins[i], count);
+    }
+    if (inst->out) {
+        Entity* created = (Entity*)ctx->entts;
+        for (index_t i = 0; i < count; ++i) {
+            *inst->out++ = (bitecs_EntityPtr){created[i].generation, ctx->index + i};
+        }
+    }
+}
+
+bool bitecs_entt_instantiate(bitecs_registry *reg, bitecs_EntityPtr prefab, bitecs_index_t count, bitecs_EntityPtr *out)
+{
+    const Entity* e = deref(reg, prefab);
+    if (unlikely(!e)) return false;
+    ArchetypeComps cache = {0};
+    cache.dict = dead_entt;
+    archetype_comps(&cache, e);
+    for (int i = 0; i < cache.ncomps; ++i) {
+        const bitecs_ComponentMeta* meta = &reg_list(reg, cache.comps[i])->meta;
+        if ((meta->deleter || meta->relocater) && !meta->copier) return false; // not copyable
+    }
+    bitecs_ComponentsList list = {{e->dict, e->components}, cache.comps, (unsigned)cache.ncomps};
+    InstantiateCtx ctx = {reg, prefab.index, cache.comps, cache.ncomps, out};
+    return bitecs_entt_create(reg, count, &list, instantiate_creator, &ctx);
+}
+
+// clone/merge
+
+bool bitecs_registry_merge_other(bitecs_registry *reg, bitecs_registry *from)
+{
+    index_t was = reg->entities_count;
+    index_t append = from->entities_count;
+    if (unlikely(!entities_own(reg) || !entities_own(from))) {
+        return false;
+    }
+    if (unlikely(!reserve_entts(reg, was + append))) {
+        return false;
+    }
+    memcpy(reg->entities + was, from->entities, sizeof(Entity) * append);
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* src = reg_list(from, comp);
+        if (src) {
+            component_list* dest = reg_list_use(reg, comp);
+            bool ok = dest && reserve_chunks(dest, was, append)
+                && chunks_own(reg, comp, was, append)
+                && chunks_own(from, comp, 0, append);
+            if (unlikely(!ok)) {
+                return false;
+            }
+        }
+    }
+    from->chunks_cleanup_pending = true;
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* src = reg_list(from, comp);
+        if (!src) continue;
+        component_list* dest = reg_list(reg, comp);
+        assert(dest && "Merging missmatching registry");
+        index_t cursor = 0;
+        index_t end;
+        while (next_component_run(from->entities, append, comp, &cursor, &end)) {
+            while (cursor < end) {
+                void* fromPtr;
+                void* intoPtr;
+                index_t selected = select_up_to_chunk(src, cursor, end - cursor, &fromPtr);
+                bool ok = component_add_range(dest, was + cursor, selected, &intoPtr, &selected);
+                if (unlikely(!ok)) {
+                    return false; //oom
+                }
+                if (src->meta.typesize) {
+                    relocate(src, fromPtr, selected, intoPtr);
+                    if (!is_sparse(src)) {
+                        src->chunks[cursor >> components_shift(src)]->header.nalives -= selected;
+                    }
+                }
+                src->nalives -= selected;
+                cursor += selected;
+            }
+        }
+        if (is_sparse(src)) {
+            // everything got relocated out
+            components_free_storage(src);
+            src->chunks = NULL;
+            src->nchunks = 0;
+            src->pages = NULL;
+            src->npages = 0;
+            src->dense = NULL;
+            src->dense_owners = NULL;
+            src->ndense = src->dense_cap = 0;
+        }
+    }
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* dest = reg_list(reg, comp);
+        if (dest && dest->nadded) mirror_added(dest);
+    }
+    reg->entities_count += from->entities_count;
+    from->entities_count = 0;
+    return true;
+}
+
+bool bitecs_registry_clone_settings(bitecs_registry *reg, bitecs_registry *out)
+{
+    if (out->schema == reg->schema) return true;
+    for (int i = 0; i < BITECS_BITS_IN_DICT; ++i) {
+        if (out->components[i]) return false; // out already has storage of its own components
+    }
+    bitecs_schema_release(out->schema);
+    out->schema = bitecs_schema_retain(reg->schema);
+    return true;
+}
+
+static bool components_fork(component_list* list, const component_list* from)
+{
+    list->nalives = from->nalives;
+    if (from->nchunks) {
+        list->chunks = mem_alloc(list->alloc, sizeof(Chunk*) * from->nchunks, bitecs_alloc_index);
+        if (unlikely(!list->chunks)) return false;
+        list->nchunks = from->nchunks;
+        for (size_t i = 0; i < from->nchunks; ++i) {
+            Chunk* shared = from->chunks[i];
+            if (shared) {
+                atomic_fetch_add_explicit(&shared->header.refs, 1, memory_order_relaxed);
+                list->chunk_allocs++;
+            }
+            list->chunks[i] = shared;
+        }
+    }
+    // sparse storage is tiny by definition: plain copy
+    if (from->ndense && unlikely(!sparse_reserve_dense(list, from->ndense))) return false;
+    for (index_t i = 0; i < from->ndense; ++i) {
+        index_t owner = from->dense_owners[i];
+        if (unlikely(!sparse_reserve_pages(list, owner, 1))) return false;
+        sparse_set_slot(list, owner, i);
+        list->dense_owners[i] = owner;
+    }
+    if (from->ndense && list->meta.copier) {
+        list->meta.copier(from->dense, from->ndense, list->dense);
+    } else if (from->ndense) {
+        memcpy(list->dense, from->dense, (size_t)from->ndense * list->meta.typesize);
+    }
+    list->ndense = from->ndense;
+    return true;
+}
+
+bitecs_registry* bitecs_registry_fork(bitecs_registry *reg)
+{
+    if (reg->arena) return NULL;
+    for (int i = 0; i < BITECS_MAX_COMPONENTS; ++i) {
+        component_list* list = reg_list(reg, i);
+        if (list && list->meta.deleter && !list->meta.copier) return NULL;
+        if (list && is_double_buffered(list)) return NULL;
+    }
+    bitecs_registry* res = bitecs_registry_new_schema(reg->schema, &reg->alloc);
+    if (unlikely(!res)) return NULL;
+    res->forked = true;
+    res->placement = reg->placement;
+    res->generation = reg->generation;
+    res->chunks_cleanup_pending = atomic_load_explicit(&reg->chunks_cleanup_pending, memory_order_relaxed);
+    for (int i = 0; i < BITECS_MAX_COMPONENTS; ++i) {
+        component_list* list = reg_list(reg, i);
+        if (!list) continue;
+        component_list** slot = reg_list_slot(res, i);
+        if (unlikely(!slot || !(*slot = components_new(list->meta, &res->alloc)))) goto err;
+        if (unlikely(!components_fork(*slot, list))) goto err;
+    }
+    FreeList* last = NULL;
+    for (FreeList* node = reg->freeList; node; node = node->next) {
+        FreeList* copy = mem_alloc(&res->alloc, sizeof(FreeList), bitecs_alloc_index);
+        if (unlikely(!copy)) goto err;
+        *copy = *node;
+        copy->prev = last;
+        copy->next = NULL;
+        *(last ? &last->next : &res->freeList) = copy;
+        last = copy;
+    }
+    res->total_free = reg->total_free;
+    if (reg->entities) {
+        if (!reg->entities_refs) {
+            reg->entities_refs = mem_alloc(&reg->alloc, sizeof(size_t), bitecs_alloc_index);
+            if (unlikely(!reg->entities_refs)) goto err;
+            atomic_init(reg->entities_refs, 1);
+        }
+        atomic_fetch_add_explicit(reg->entities_refs, 1, memory_order_relaxed);
+        res->entities_refs = reg->entities_refs;
+        res->entities = reg->entities;
+        res->entities_count = reg->entities_count;
+        res->entities_cap = reg->entities_cap;
+    }
+    reg->forked = true;
+    return res;
+err:
+    bitecs_registry_delete(res);
+    return NULL;
+}
+
+bitecs_EntityProxy* bitecs_entt_deref(bitecs_registry *reg, bitecs_EntityPtr ptr)
+{
+    if (unlikely(!entities_own(reg))) return NULL;
+    return (bitecs_EntityProxy*)deref(reg, ptr);
+}
+
+// frequency tuning
+
+static size_t chunks_alive(component_list* list) {
+    return list->chunk_allocs - list->chunk_frees;
+}
+
+static size_t components_bytes(component_list* list)
+{
+    size_t res = sizeof(component_list);
+    res += list->nchunks * sizeof(Chunk*);
+    res += chunks_alive(list) * chunk_sizeof(list);
+    // (diverged and spare chunks are in chunks_alive() already)
+    if (is_double_buffered(list)) {
+        res += list->nchunks * sizeof(Chunk*) + list->added_cap * sizeof(IndexRange);
+    }
+    res += list->npages * sizeof(index_t*);
+    for (size_t i = 0; i < list->npages; ++i) {
+        if (list->pages[i]) res += sizeof(index_t) * SPARSE_PAGE_SIZE;
+    }
+    res += (size_t)list->dense_cap * (list->meta.typesize + sizeof(index_t));
+    return res;
+}
+
+static size_t empty_chunks(component_list* list)
+{
+    size_t res = 0;
+    for (size_t ch = 0; ch < list->nchunks; ++ch) {
+        Chunk* current = list->chunks[ch];
+        res += current && !current->header.nalives;
+    }
+    return res;
+}
+
+bool bitecs_component_stats(bitecs_registry *reg, bitecs_comp_id_t id, bitecs_ComponentStats *out)
+{
+    component_list* list = reg_list(reg, id);
+    if (!list) {
+        // defined, but never used: no storage yet
+        const bitecs_ComponentMeta* meta = schema_meta(reg->schema, id);
+        if (!meta) return false;
+        *out = (bitecs_ComponentStats){0};
+        out->id = id;
+        out->frequency = meta->frequency;
+        return true;
+    }
+    out->id = id;
+    out->frequency = list->meta.frequency;
+    out->nalives = list->nalives;
+    out->nchunks = chunks_alive(list);
+    out->capacity = is_sparse(list) ? list->dense_cap : out->nchunks * components_in_chunk(list);
+    out->empty_chunks = empty_chunks(list);
+    out->bytes = components_bytes(list);
+    out->chunk_allocs = list->chunk_allocs;
+    out->chunk_frees = list->chunk_frees;
+    return true;
+}
+
+// registry stats
+
+typedef struct {
+    bitecs_ArchetypeStats* slots;
+    size_t cap;
+    size_t count;
+} archetypes_set;
+
+static size_t archetype_hash(dict_t dict, mask_t mask) {
+    uint64_t h = (dict * 0x9E3779B97F4A7C15ull) ^ mask;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 32);
+}
+
+static bitecs_ArchetypeStats* archetypes_find(archetypes_set* set, dict_t dict, mask_t mask) {
+    size_t i = archetype_hash(dict, mask) & (set->cap - 1);
+    while (set->slots[i].count && (set->slots[i].dict != dict || set->slots[i].components != mask)) {
+        i = (i + 1) & (set->cap - 1);
+    }
+    return set->slots + i;
+}
+
+static bool archetypes_add(const bitecs_Allocator* alloc, archetypes_set* set, dict_t dict, mask_t mask) {
+    if ((set->count + 1) * 2 > set->cap) {
+        size_t newCap = set->cap ? set->cap * 2 : 64;
+        bitecs_ArchetypeStats* newSlots = mem_alloc(alloc, sizeof(bitecs_ArchetypeStats) * newCap, bitecs_alloc_temp);
+        if (unlikely(!newSlots)) return false;
+        memset(newSlots, 0, sizeof(bitecs_ArchetypeStats) * newCap);
+        archetypes_set grown = {newSlots, newCap, set->count};
+        for (size_t i = 0; i < set->cap; ++i) {
+            if (set->slots[i].count) {
+                *archetypes_find(&grown, set->slots[i].dict, set->slots[i].components) = set->slots[i];
+            }
+        }
+        mem_free(alloc, set->slots, sizeof(bitecs_ArchetypeStats) * set->cap, bitecs_alloc_temp);
+        *set = grown;
+    }
+    bitecs_ArchetypeStats* slot = archetypes_find(set, dict, mask);
+    if (!slot->count) {
+        slot->dict = dict;
+        slot->components = mask;
+        set->count++;
+    }
+    slot->count++;
     return true;
 }
 
-static void do_destroy_batch(bitecs_registry *reg, bitecs_index_t ptr, index_t count)
+static int archetypes_cmp(const void* l, const void* r) {
+    bitecs_index_t lc = ((const bitecs_ArchetypeStats*)l)->count;
+    bitecs_index_t rc = ((const bitecs_ArchetypeStats*)r)->count;
+    return lc < rc ? 1 : lc > rc ? -1 : 0;
+}
+
+bool bitecs_registry_stats(bitecs_registry *reg, bitecs_RegistryStats *out)
 {
-    reg->chunks_cleanup_pending = true;
-    dict_t wasDict = dead_entt;
-    mask_t wasMask = 0;
-    int ncomps = 0;
-    index_t same_arch_begin = ptr;
-    for (index_t i = ptr; i < ptr + count; ++i) {
+    *out = (bitecs_RegistryStats){0};
+    out->entities_cap = reg->entities_cap;
+    out->bytes_total = sizeof(bitecs_registry) + sizeof(Entity) * reg->entities_cap;
+    for (FreeList* node = reg->freeList; node; node = node->next) {
+        out->free_nodes++;
+        out->free_total += node->count;
+        out->free_largest = node->count > out->free_largest ? node->count : out->free_largest;
+        out->bytes_total += sizeof(FreeList);
+    }
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        out->ncomponents += schema_meta(reg->schema, comp) != NULL;
+    }
+    for (int group = 0; group < BITECS_BITS_IN_DICT; ++group) {
+        out->bytes_total += reg->components[group] ? sizeof(component_list*) * BITECS_GROUP_SIZE : 0;
+    }
+    out->components = malloc(sizeof(bitecs_ComponentStats) * (out->ncomponents ? out->ncomponents : 1));
+    if (unlikely(!out->components)) goto err;
+    size_t ci = 0;
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        bitecs_ComponentStats* current = out->components + ci;
+        if (!bitecs_component_stats(reg, comp, current)) continue;
+        out->pending_cleanup_chunks += current->empty_chunks;
+        out->bytes_total += current->bytes;
+        ci++;
+    }
+    archetypes_set set = {0};
+    for (index_t i = 0; i < reg->entities_count; ++i) {
         Entity* e = reg->entities + i;
-        assert(e->dict != dead_entt);
-        if (e->dict != wasDict || e->components != wasMask) {
-            wasDict = e->dict;
-            wasMask = e->components;
-            bitecs_BitsStorage storage;
-            Ranks ranks;
-            bitecs_ranks_get(&ranks, e->dict);
-            ncomps = bitecs_mask_into_array((const SparseMask*)e, &ranks, storage);
-            for (int ci = 0; ci < ncomps; ++ci) {
-                int comp = storage[ci];
-                component_list* list = reg->components[comp];
-                assert(list && "Attempt to delete entt with nonexistend component");
-                index_t cursor = same_arch_begin;
-                index_t cursor_count = i + 1 - same_arch_begin;
-                do {
-                    void* begin;
-                    index_t selected = select_up_to_chunk(list, cursor, cursor_count, &begin);
-                    if (list->meta.deleter) {
-                        list->meta.deleter(begin, selected);
-                    }
-                    index_t chunk = cursor >> components_shift(list);
-                    list->chunks[chunk]->header.nalives -= selected;
-                    cursor += selected;
-                    cursor_count -= selected;
-                } while(cursor_count);
-            }
-            same_arch_begin = i;
+        if (e->dict == dead_entt) {
+            out->entities_dead++;
+            continue;
+        }
+        out->entities_live++;
+        if (unlikely(!archetypes_add(&reg->alloc, &set, e->dict, e->components))) {
+            mem_free(&reg->alloc, set.slots, sizeof(bitecs_ArchetypeStats) * set.cap, bitecs_alloc_temp);
+            goto err;
         }
-        e->generation = reg->generation;
-        e->dict = dead_entt;
     }
-    if (likely(add_free(&reg->freeList, ptr, count))) {
-        reg->total_free += count;
+    // stats may outlive registry: result goes to heap
+    out->archetypes = malloc(sizeof(bitecs_ArchetypeStats) * (set.count ? set.count : 1));
+    if (unlikely(!out->archetypes)) {
+        mem_free(&reg->alloc, set.slots, sizeof(bitecs_ArchetypeStats) * set.cap, bitecs_alloc_temp);
+        goto err;
     }
-}
-
-void bitecs_entt_destroy_batch(bitecs_registry *reg, const bitecs_EntityPtr *ptrs, size_t nptrs)
-{
-    reg->generation++;
-    bitecs_index_t begin = 0;
-    bitecs_index_t count = 0;
-    for (size_t i = 0; i < nptrs; ++i) {
-        const bitecs_EntityPtr* ptr = ptrs + i;
-        Entity* e = deref(reg, *ptr);
-        if (e) {
-            if (!count) {
-                begin = ptr->index;
-                continue;
-            }
-            count++;
-            if (ptr->index != begin + count) {
-                do_destroy_batch(reg, begin, count);
-                count = 0;
-                begin = ptr->index;
-            }
-        } else if (count) {
-            do_destroy_batch(reg, begin, count);
-            count = 0;
+    for (size_t i = 0; i < set.cap; ++i) {
+        if (set.slots[i].count) {
+            out->archetypes[out->narchetypes++] = set.slots[i];
         }
     }
-    if (count) {
-        do_destroy_batch(reg, begin, count);
-    }
+    mem_free(&reg->alloc, set.slots, sizeof(bitecs_ArchetypeStats) * set.cap, bitecs_alloc_temp);
+    qsort(out->archetypes, out->narchetypes, sizeof(bitecs_ArchetypeStats), archetypes_cmp);
+    return true;
+err:
+    bitecs_registry_stats_free(out);
+    return false;
 }
 
-void bitecs_entt_destroy(bitecs_registry *reg, bitecs_EntityPtr ptr)
+void bitecs_registry_stats_free(bitecs_RegistryStats *stats)
 {
-    Entity* e = deref(reg, ptr);
-    if (unlikely(!e)) return;
-    reg->generation++;
-    do_destroy_batch(reg, ptr.index, 1);
+    free(stats->components);
+    free(stats->archetypes);
+    stats->components = NULL;
+    stats->archetypes = NULL;
+    stats->ncomponents = 0;
+    stats->narchetypes = 0;
 }
 
-// clone/merge
+bitecs_Frequency bitecs_component_suggest_frequency(bitecs_registry *reg, bitecs_comp_id_t id)
+{
+    component_list* list = reg_list(reg, id);
+    if (!list) return bitecs_freq1;
+    int freq = list->meta.frequency;
+    size_t nchunks = chunks_alive(list);
+    if (!list->meta.typesize || is_sparse(list) || !nchunks) return freq;
+    size_t capacity = nchunks * components_in_chunk(list);
+    if (list->nalives * 4 >= capacity * 3) {
+        // dense: bigger chunks -> less batch splitting
+        return freq < bitecs_freq9 ? freq + 1 : freq;
+    }
+    if (list->nalives * 4 >= capacity) {
+        return freq;
+    }
+    // sparse: halving chunks of scattered components about halves capacity
+    while (freq > bitecs_freq1 && list->nalives * 2 < capacity) {
+        freq--;
+        capacity /= 2;
+    }
+    return freq;
+}
 
-bool bitecs_registry_merge_other(bitecs_registry *reg, bitecs_registry *from)
+bool bitecs_component_rechunk(bitecs_registry *reg, bitecs_comp_id_t id, bitecs_Frequency freq)
 {
-    index_t was = reg->entities_count;
-    index_t append = from->entities_count;
-    if (unlikely(!reserve_entts(reg, was + append))) {
+    component_list* list = reg_list_use(reg, id);
+    if (!list || is_sparse(list) || is_double_buffered(list) || freq < bitecs_freq1 || freq > bitecs_freq9) {
         return false;
     }
-    memcpy(reg->entities + was, from->entities, sizeof(Entity) * append);
-    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
-        component_list* src = from->components[comp];
-        if (src) {
-            component_list* dest = reg->components[comp];
-            bool ok = reserve_chunks(dest, was, append);
-            if (unlikely(!ok)) {
-                return false;
-            }
+    if (list->meta.frequency == freq) return true;
+    if (!list->meta.typesize) {
+        list->meta.frequency = freq;
+        return true;
+    }
+    for (size_t chunk = 0; reg->forked && chunk < list->nchunks; ++chunk) {
+        if (unlikely(!chunk_own(reg, id, chunk))) return false;
+    }
+    component_list fresh = *list;
+    fresh.chunks = NULL;
+    fresh.nchunks = 0;
+    fresh.nalives = 0;
+    fresh.meta.frequency = freq;
+    if (unlikely(!reserve_chunks(&fresh, 0, reg->entities_count))) return false;
+    // allocate everything upfront -> moving components below cannot fail halfway
+    index_t cursor = 0;
+    index_t end;
+    while (next_component_run(reg->entities, reg->entities_count, id, &cursor, &end)) {
+        for (; cursor < end; ++cursor) {
+            Chunk** owner = fresh.chunks + (cursor >> components_shift(&fresh));
+            if (!*owner && unlikely(!(*owner = chunk_new(&fresh)))) goto oom;
         }
     }
-    from->chunks_cleanup_pending = true;
-    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
-        component_list* src = from->components[comp];
-        component_list* dest = reg->components[comp];
-        assert((bool)src == (bool)dest && "Merging missmatching registry");
-        if (!src) continue;
-        index_t inputCursor = 0;
-        index_t outputCursor = was;
-        index_t count = append;
-        while (count) {
-            void* fromPtr;
-            void* intoPtr;
-            index_t selected = select_up_to_chunk(src, inputCursor, count, &fromPtr);
-            index_t selectedDest;
-            bool ok = component_add_range(dest, outputCursor, count, &intoPtr, &selectedDest);
-            if (unlikely(!ok)) {
-                return false; //oom
-            }
-            selected = selected < selectedDest ? selected : selectedDest;
-            if (src->meta.typesize) {
-                if (src->meta.relocater) {
-                    src->meta.relocater(fromPtr, selected, intoPtr);
-                } else {
-                    memcpy(intoPtr, fromPtr, selected * src->meta.typesize);
-                }
-            }
-            inputCursor += selected;
-            outputCursor += selected;
-            count -= selected;
+    cursor = 0;
+    while (next_component_run(reg->entities, reg->entities_count, id, &cursor, &end)) {
+        while (cursor < end) {
+            void* from;
+            void* into;
+            index_t added;
+            index_t selected = select_up_to_chunk(list, cursor, end - cursor, &from);
+            (void)component_add_range(&fresh, cursor, selected, &into, &added);
+            relocate(list, from, added, into);
+            cursor += added;
         }
     }
-    reg->entities_count += from->entities_count;
-    from->entities_count = 0;
+    for (size_t i = 0; i < list->nchunks; ++i) {
+        if (!list->chunks[i]) continue;
+        chunk_release(list, list->chunks[i]);
+        fresh.chunk_frees++;
+    }
+    mem_free(list->alloc, list->chunks, sizeof(Chunk*) * list->nchunks, bitecs_alloc_index);
+    *list = fresh;
     return true;
-}
-
-bool bitecs_registry_clone_settings(bitecs_registry *reg, bitecs_registry *out)
-{
-    for (int i = 0; i < BITECS_MAX_COMPONENTS; ++i) {
-        out->components[i] = reg->components[i];
+oom:
+    for (size_t i = 0; i < fresh.nchunks; ++i) {
+        chunk_release(&fresh, fresh.chunks[i]);
     }
+    mem_free(fresh.alloc, fresh.chunks, sizeof(Chunk*) * fresh.nchunks, bitecs_alloc_index);
     return false;
 }
 
-bitecs_EntityProxy* bitecs_entt_deref(bitecs_registry *reg, bitecs_EntityPtr ptr)
-{
-    return (bitecs_EntityProxy*)deref(reg, ptr);
-}
-
-
 void bitecs_ranks_get(bitecs_Ranks* res, dict_t dict)
 {
     assert(dict_popcnt(dict) <= BITECS_GROUPS_COUNT);
     *res = (bitecs_Ranks){0};
-    int rank = 0;
     while(dict) {
-        int trailing = ctz(dict);
-        rank += trailing;
+        int rank = dict_ctz(dict);
         int i = res->groups_count++;
         res->group_ranks[i] = rank;
         res->select_dict_masks[i] = fill_up_to(rank);
-        dict >>= trailing + 1;
-        rank++;
+        dict &= dict - 1;
     }
     if (res->groups_count) {
         res->highest_select_mask = res->select_dict_masks[res->groups_count - 1];
     }
 }
 
+#ifdef MASK_PDEP
+// lanes of entt mask, taken by query groups -> deposit query groups into them
+static mask_t adjust_for(dict_t qdict, dict_t diff, mask_t qmask, const dict_t* restrict rankMasks) {
+    (void)rankMasks;
+    dict_t slots = _pext_u64(qdict, qdict | diff);
+    mask_t lanes = _pdep_u64(slots, 0x0001000100010001ull) * 0xFFFFull;
+    return _pdep_u64(qmask, lanes);
+}
+#else
 static mask_t relocate_part(dict_t dictDiff, mask_t mask, int index, const dict_t* restrict rankMasks) {
     dict_t select_mask = rankMasks[index];
     int shift = dict_popcnt(dictDiff & select_mask) * BITECS_GROUP_SIZE;
@@ -659,13 +3261,15 @@ static mask_t relocate_part(dict_t dictDiff, mask_t mask, int index, const dict_
     return value << shift;
 }
 
-static mask_t adjust_for(dict_t diff, mask_t qmask, const dict_t* restrict rankMasks) {
+static mask_t adjust_for(dict_t qdict, dict_t diff, mask_t qmask, const dict_t* restrict rankMasks) {
+    (void)qdict;
     mask_t r0 = relocate_part(diff, qmask, 0, rankMasks);
     mask_t r1 = relocate_part(diff, qmask, 1, rankMasks);
     mask_t r2 = relocate_part(diff, qmask, 2, rankMasks);
     mask_t r3 = relocate_part(diff, qmask, 3, rankMasks);
     return r0 | r1 | r2 | r3;
 }
+#endif
 
 static bool needs_adjust(dict_t diff, const Ranks* ranks) {
     return diff && diff & ranks->highest_select_mask;
@@ -688,7 +3292,7 @@ static index_t bitecs_query_match(
         dict_t diff = edict ^ qdict;
         mask_t mask = query->bits;
         if (unlikely(needs_adjust(diff, ranks))) {
-            mask = adjust_for(diff, query->bits, ranks->select_dict_masks);
+            mask = adjust_for(qdict, diff, query->bits, ranks->select_dict_masks);
         }
         mask_t ecomps = entt->components;
         if ((ecomps & mask) == mask) {
@@ -702,31 +3306,25 @@ static bitecs_index_t bitecs_query_miss(
     bitecs_index_t cursor, const QueryCtx* ctx,
     const bitecs_Entity* entts, bitecs_index_t count)
 {
-    bitecs_SparseMask adjusted;
     bitecs_flags_t flags = ctx->flags;
     const bitecs_Ranks* ranks = &ctx->ranks;
-    const bitecs_SparseMask* orig_query = &ctx->query;
-    const bitecs_SparseMask* query = orig_query;
+    const bitecs_SparseMask* query = &ctx->query;
+    // adjusted query for last seen dict (always from original query)
+    dict_t last_dict = query->dict;
+    mask_t mask = query->bits;
     for (;cursor < count; ++cursor) {
         const Entity* entt = entts + cursor;
-    again:
-        if (unlikely(entt->dict == dead_entt)) return cursor;
+        dict_t edict = entt->dict;
+        if (unlikely(edict == dead_entt)) return cursor;
         if ((entt->flags & flags) != flags) return cursor;
-        if ((entt->dict & query->dict) != query->dict) {
-            // missmatch on adjusted query is not definitive!
-            if (query != orig_query) {
-                query = orig_query;
-                goto again;
+        if (edict != last_dict) {
+            if ((edict & query->dict) != query->dict) return cursor;
+            dict_t diff = edict ^ query->dict;
+            mask = query->bits;
+            if (unlikely(needs_adjust(diff, ranks))) {
+                mask = adjust_for(query->dict, diff, query->bits, ranks->select_dict_masks);
             }
-            return cursor;
-        }
-        dict_t diff = entt->dict ^ query->dict;
-        mask_t mask = query->bits;
-        if (unlikely(needs_adjust(diff, ranks))) {
-            mask = adjust_for(diff, query->bits, ranks->select_dict_masks);
-            adjusted.bits = mask;
-            adjusted.dict = entt->dict;
-            query = &adjusted;
+            last_dict = edict;
         }
         if ((entt->components & mask) != mask) {
             return cursor;
@@ -735,6 +3333,93 @@ static bitecs_index_t bitecs_query_miss(
     return cursor;
 }
 
+// adjusted query for last seen dict
+typedef struct {
+    dict_t dict;
+    mask_t mask;
+    bool ok;
+} QueryCache;
+
+static void query_cache_update(const QueryCtx* ctx, QueryCache* cache, dict_t edict) {
+    dict_t qdict = ctx->query.dict;
+    cache->dict = edict;
+    cache->ok = edict != dead_entt && (edict & qdict) == qdict;
+    if (!cache->ok) return;
+    dict_t diff = edict ^ qdict;
+    cache->mask = needs_adjust(diff, &ctx->ranks)
+        ? adjust_for(qdict, diff, ctx->query.bits, ctx->ranks.select_dict_masks)
+        : ctx->query.bits;
+}
+
+// bit i is set, if entts[i] matches (count <= 64). Only dict changes branch
+static uint64_t query_match_bits(const QueryCtx* ctx, QueryCache* cache, const Entity* entts, index_t count) {
+    bitecs_flags_t flags = ctx->flags;
+    uint64_t bits = 0;
+    for (index_t i = 0; i < count; ++i) {
+        const Entity* entt = entts + i;
+        if (unlikely(entt->dict != cache->dict)) {
+            query_cache_update(ctx, cache, entt->dict);
+        }
+        bool hit = cache->ok
+            & ((entt->components & cache->mask) == cache->mask)
+            & ((entt->flags & flags) == flags);
+        bits |= (uint64_t)hit << i;
+    }
+    return bits;
+}
+
+static void query_ctx_init(QueryCtx* ctx, const bitecs_ComponentsList* comps, bitecs_flags_t flags) {
+    ctx->flags = flags;
+    ctx->query = comps->mask;
+    bitecs_ranks_get(&ctx->ranks, ctx->query.dict);
+}
+
+bitecs_index_t bitecs_query_count(bitecs_registry *reg, const bitecs_ComponentsList *comps, bitecs_flags_t flags)
+{
+    QueryCtx ctx;
+    query_ctx_init(&ctx, comps, flags);
+    QueryCache cache = {dead_entt, 0, false};
+    index_t res = 0;
+    const Entity* entts = reg->entities;
+    // branch free sum (runs of same dict are common)
+    for (index_t i = 0; i < reg->entities_count; ++i) {
+        if (unlikely(entts[i].dict != cache.dict)) {
+            query_cache_update(&ctx, &cache, entts[i].dict);
+        }
+        res += cache.ok & ((entts[i].components & cache.mask) == cache.mask) & ((entts[i].flags & flags) == flags);
+    }
+    return res;
+}
+
+bitecs_index_t bitecs_query_collect(
+    bitecs_registry *reg, const bitecs_ComponentsList *comps, bitecs_flags_t flags,
+    bitecs_EntityPtr *out, size_t cap)
+{
+    QueryCtx ctx;
+    query_ctx_init(&ctx, comps, flags);
+    QueryCache cache = {dead_entt, 0, false};
+    size_t res = 0;
+    for (index_t i = 0; i < reg->entities_count; i += 64) {
+        index_t n = reg->entities_count - i < 64 ? reg->entities_count - i : 64;
+        uint64_t bits = query_match_bits(&ctx, &cache, reg->entities + i, n);
+        if (res + (size_t)dict_popcnt(bits) <= cap) {
+            for (; bits; bits &= bits - 1) {
+                index_t index = i + (index_t)dict_ctz(bits);
+                out[res++] = (bitecs_EntityPtr){reg->entities[index].generation, index};
+            }
+        } else {
+            for (; bits; bits &= bits - 1) {
+                if (res < cap) {
+                    index_t index = i + (index_t)dict_ctz(bits);
+                    out[res] = (bitecs_EntityPtr){reg->entities[index].generation, index};
+                }
+                res++;
+            }
+        }
+    }
+    return (index_t)res;
+}
+
 _BITECS_FLATTEN
 bool bitecs_mask_set(bitecs_SparseMask* mask, int index, bool state)
 {
@@ -749,7 +3434,7 @@ bool bitecs_mask_set(bitecs_SparseMask* mask, int index, bool state)
         }
         dict_t newDict = mask->dict | ((dict_t)1 << group);
         dict_t diff = newDict ^ mask->dict;
-        mask->bits = adjust_for(diff, mask->bits, ranks.select_dict_masks);
+        mask->bits = adjust_for(mask->dict, diff, mask->bits, ranks.select_dict_masks);
         mask->dict = newDict;
     }
     int groupIndex = dict_popcnt(mask->dict & fill_up_to(group));
@@ -762,7 +3447,7 @@ bool bitecs_mask_set(bitecs_SparseMask* mask, int index, bool state)
         res = mask->bits & ~selector;
         bitecs_mask_t selectGroup = ((bitecs_mask_t)fill_up_to(BITECS_GROUP_SIZE)) << (groupIndex * BITECS_GROUP_SIZE);
         if (unlikely(!(res & selectGroup))) { //last bit in group
-            mask->dict &= ~(1 << group); //unset group in dict
+            mask->dict &= ~((dict_t)1 << group); //unset group in dict
         }
     }
     mask->bits = res;
@@ -775,12 +3460,11 @@ bool bitecs_mask_get(const bitecs_SparseMask* mask, int index)
     assert(index < BITECS_MAX_COMPONENTS);
     int group = index >> BITECS_GROUP_SHIFT;
     int bit = index & fill_up_to(BITECS_GROUP_SHIFT);
+    dict_t temp_dict = (dict_t)1 << group;
+    if (!(mask->dict & temp_dict)) return false;
     int groupIndex = dict_popcnt(mask->dict & fill_up_to(group));
     int shift = groupIndex * BITECS_GROUP_SIZE + bit;
-    dict_t temp_dict = (dict_t)1 << group;
-    bool dict_match = mask->dict & temp_dict;
-    bool bits_match = mask->bits & (mask_t)1 << shift;
-    return dict_match && bits_match;
+    return mask->bits & (mask_t)1 << shift;
 }
 
 _BITECS_FLATTEN
@@ -818,6 +3502,22 @@ bool bitecs_mask_from_array(bitecs_SparseMask *maskOut, const int *idxs, unsigne
     return true;
 }
 
+#ifdef MASK_PDEP
+_BITECS_FLATTEN
+unsigned bitecs_mask_into_array(const bitecs_SparseMask *mask, const bitecs_Ranks *ranks, int *storage)
+{
+    // single pass over set bits, no per-group loops
+    mask_t bits = mask->bits;
+    unsigned out = 0;
+    while (bits) {
+        int bit = dict_ctz(bits);
+        int group = ranks->group_ranks[bit >> BITECS_GROUP_SHIFT];
+        storage[out++] = (group << BITECS_GROUP_SHIFT) + (bit & fill_up_to(BITECS_GROUP_SHIFT));
+        bits &= bits - 1;
+    }
+    return out;
+}
+#else
 static void expand_one(int bitOffset, uint16_t part, int offset, int *storage) {
     int bit = 0;
     int out = 0;
@@ -844,6 +3544,23 @@ unsigned bitecs_mask_into_array(const bitecs_SparseMask *mask, const bitecs_Rank
     expand_one(ranks->group_ranks[3] << BITECS_GROUP_SHIFT, groups[3], pcnt0 + pcnt1 + pcnt2, storage);
     return pcnt0 + pcnt1 + pcnt2 + pcnt3;
 }
+#endif
+
+bitecs_mask_t bitecs_mask_adjust(bitecs_dict_t qdict, bitecs_mask_t qmask, const bitecs_Ranks *ranks, bitecs_dict_t edict)
+{
+    dict_t diff = edict ^ qdict;
+    if (!needs_adjust(diff, ranks)) return qmask;
+    return adjust_for(qdict, diff, qmask, ranks->select_dict_masks);
+}
+
+const char* bitecs_mask_impl(void)
+{
+#ifdef MASK_PDEP
+    return "pdep";
+#else
+    return "shift";
+#endif
+}
 
 typedef struct {
     int comp_id;
@@ -856,15 +3573,15 @@ struct bitecs_cleanup_data {
     chunk_cleanup_data* chunks;
 };
 
-static bool add_to_cleanup(bitecs_cleanup_data* data, chunk_cleanup_data cd) {
+static bool add_to_cleanup(const bitecs_Allocator* alloc, bitecs_cleanup_data* data, chunk_cleanup_data cd) {
     if (data->chunks_cap == data->nchunks) {
         unsigned newCap = data->chunks_cap ? data->chunks_cap * 2 : 2;
-        chunk_cleanup_data* newData = malloc(sizeof(chunk_cleanup_data) * newCap);
+        chunk_cleanup_data* newData = mem_alloc(alloc, sizeof(chunk_cleanup_data) * newCap, bitecs_alloc_temp);
         if (unlikely(!newData)) return false;
         if (data->chunks) {
             memcpy(newData, data->chunks, sizeof(chunk_cleanup_data) * data->nchunks);
         }
-        free(data->chunks);
+        mem_free(alloc, data->chunks, sizeof(chunk_cleanup_data) * data->chunks_cap, bitecs_alloc_temp);
         data->chunks = newData;
         data->chunks_cap = newCap;
     }
@@ -872,19 +3589,19 @@ static bool add_to_cleanup(bitecs_cleanup_data* data, chunk_cleanup_data cd) {
     return true;
 }
 
-static void destroy_cleanup(bitecs_cleanup_data* data) {
-    free(data->chunks);
-    free(data);
+static void destroy_cleanup(const bitecs_Allocator* alloc, bitecs_cleanup_data* data) {
+    mem_free(alloc, data->chunks, sizeof(chunk_cleanup_data) * data->chunks_cap, bitecs_alloc_temp);
+    mem_free(alloc, data, sizeof(bitecs_cleanup_data), bitecs_alloc_temp);
 }
 
 bitecs_cleanup_data *bitecs_cleanup_prepare(bitecs_registry *reg)
 {
-    bitecs_cleanup_data* res = malloc(sizeof(bitecs_cleanup_data));
+    bitecs_cleanup_data* res = mem_alloc(&reg->alloc, sizeof(bitecs_cleanup_data), bitecs_alloc_temp);
     if (!res) return NULL;
     *res = (bitecs_cleanup_data){0};
     if (reg->chunks_cleanup_pending) {
         for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
-            component_list* list = reg->components[comp];
+            component_list* list = reg_list(reg, comp);
             if (!list) continue;
             for (size_t ch = 0; ch < list->nchunks; ++ch) {
                 Chunk* current = list->chunks[ch];
@@ -892,14 +3609,14 @@ bitecs_cleanup_data *bitecs_cleanup_prepare(bitecs_registry *reg)
                     chunk_cleanup_data cd;
                     cd.comp_id = comp;
                     cd.chunk = ch;
-                    if (!add_to_cleanup(res, cd)) goto err;
+                    if (!add_to_cleanup(&reg->alloc, res, cd)) goto err;
                 }
             }
         }
     }
     return res;
 err:
-    destroy_cleanup(res);
+    destroy_cleanup(&reg->alloc, res);
     return NULL;
 }
 
@@ -908,24 +3625,428 @@ void bitecs_cleanup(bitecs_registry *reg, bitecs_cleanup_data *data)
     reg->chunks_cleanup_pending = false;
     for (size_t i = 0; i < data->nchunks; ++i) {
         chunk_cleanup_data* cdata = data->chunks + i;
-        component_list* list = reg->components[cdata->comp_id];
-        free(list->chunks[cdata->chunk]);
+        component_list* list = reg_list(reg, cdata->comp_id);
+        // since bitecs_cleanup_prepare(): rechunk could have moved chunks, new entts could have filled them
+        if (cdata->chunk >= list->nchunks) continue;
+        Chunk* current = list->chunks[cdata->chunk];
+        if (!current || current->header.nalives) continue;
+        if (is_double_buffered(list)) {
+            Chunk* prev = list->prev[cdata->chunk];
+            if (prev != list->chunks[cdata->chunk]) chunk_free(list, prev);
+            list->prev[cdata->chunk] = NULL;
+        }
+        chunk_free(list, current);
         list->chunks[cdata->chunk] = NULL;
     }
-    destroy_cleanup(data);
+    destroy_cleanup(&reg->alloc, data);
+    for (int comp = 0; comp < BITECS_MAX_COMPONENTS; ++comp) {
+        component_list* list = reg_list(reg, comp);
+        if (!list || !list->meta.auto_frequency) continue;
+        bitecs_Frequency freq = bitecs_component_suggest_frequency(reg, comp);
+        if (freq != list->meta.frequency && !bitecs_component_rechunk(reg, comp, freq)) {
+            // OOM: component just stays with old frequency
+            continue;
+        }
+    }
 }
 
-void bitecs_system_run_many(bitecs_registry *registry, bitecs_threadpool *tpool, bitecs_MultiSystemParams *systems)
-{
+// threadpool: one batch of tasks at a time. Workers and calling thread pull tasks
+// from shared counter, caller waits until all workers are out of batch
 
+typedef struct {
+    bitecs_threadpool* pool;
+    int id;
+#ifdef BITECS_HAS_PTHREAD
+    pthread_t thread;
+#endif
+} PoolWorker;
+
+struct bitecs_threadpool {
+    PoolWorker* workers;
+    size_t nthreads;
+#ifdef BITECS_HAS_PTHREAD
+    pthread_mutex_t lock;
+    // new batch (or stop)
+    pthread_cond_t wake;
+    // last worker left batch
+    pthread_cond_t done;
+#endif
+    bitecs_Task task;
+    void* udata;
+    size_t ntasks;
+    _Atomic(size_t) next;
+    // workers still in batch
+    size_t busy;
+    // batch number. Worker joins each batch once
+    uint64_t epoch;
+    bool stop;
+};
+
+static void pool_drain(bitecs_threadpool* pool) {
+    size_t i;
+    while ((i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed)) < pool->ntasks) {
+        pool->task(pool->udata, i);
+    }
+}
+
+#ifdef BITECS_HAS_PTHREAD
+
+static void* pool_worker(void* arg) {
+    PoolWorker* self = arg;
+    bitecs_threadpool* pool = self->pool;
+    current_worker = self->id;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->epoch == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) break;
+        seen = pool->epoch;
+        pthread_mutex_unlock(&pool->lock);
+        pool_drain(pool);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void pool_stop(bitecs_threadpool* pool, size_t started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
 }
 
+#endif
+
 bitecs_threadpool *bitecs_threadpool_new(size_t nthreads)
 {
-
+#ifndef BITECS_HAS_PTHREAD
+    nthreads = 0;
+#endif
+    bitecs_threadpool* pool = calloc(1, sizeof(bitecs_threadpool));
+    if (unlikely(!pool)) return NULL;
+    if (!nthreads) return pool;
+#ifdef BITECS_HAS_PTHREAD
+    pool->workers = calloc(nthreads, sizeof(PoolWorker));
+    if (unlikely(!pool->workers)) goto fail;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (size_t i = 0; i < nthreads; ++i) {
+        PoolWorker* worker = pool->workers + i;
+        worker->pool = pool;
+        worker->id = (int)i + 1;
+        if (unlikely(pthread_create(&worker->thread, NULL, pool_worker, worker) != 0)) {
+            pool_stop(pool, i);
+            goto fail;
+        }
+    }
+    pool->nthreads = nthreads;
+    return pool;
+fail:
+    free(pool->workers);
+    free(pool);
+#endif
+    return NULL;
 }
 
 void bitecs_threadpool_delete(bitecs_threadpool *tpool)
 {
+    if (!tpool) return;
+#ifdef BITECS_HAS_PTHREAD
+    if (tpool->nthreads) {
+        pool_stop(tpool, tpool->nthreads);
+    }
+#endif
+    free(tpool->workers);
+    free(tpool);
+}
+
+size_t bitecs_threadpool_size(bitecs_threadpool *tpool)
+{
+    return tpool ? tpool->nthreads : 0;
+}
+
+void bitecs_threadpool_run(bitecs_threadpool *tpool, bitecs_Task task, void *udata, size_t ntasks)
+{
+    if (!tpool || !tpool->nthreads || ntasks < 2) {
+        for (size_t i = 0; i < ntasks; ++i) {
+            task(udata, i);
+        }
+        return;
+    }
+#ifdef BITECS_HAS_PTHREAD
+    pthread_mutex_lock(&tpool->lock);
+    tpool->task = task;
+    tpool->udata = udata;
+    tpool->ntasks = ntasks;
+    atomic_store_explicit(&tpool->next, 0, memory_order_relaxed);
+    tpool->busy = tpool->nthreads;
+    tpool->epoch++;
+    pthread_cond_broadcast(&tpool->wake);
+    pthread_mutex_unlock(&tpool->lock);
+    pool_drain(tpool);
+    pthread_mutex_lock(&tpool->lock);
+    while (tpool->busy) {
+        pthread_cond_wait(&tpool->done, &tpool->lock);
+    }
+    pthread_mutex_unlock(&tpool->lock);
+#endif
+}
+
+int bitecs_current_worker(void)
+{
+    return current_worker;
+}
+
+static bool lists_intersect(const bitecs_ComponentsList* a, const bitecs_ComponentsList* b) {
+    if ((a->mask.dict & b->mask.dict) == 0) return false;
+    for (unsigned i = 0; i < a->ncomps; ++i) {
+        for (unsigned j = 0; j < b->ncomps; ++j) {
+            if (a->components[i] == b->components[j]) return true;
+        }
+    }
+    return false;
+}
+
+static const bitecs_ComponentsList* system_writes(const bitecs_SystemParams* params) {
+    return params->writes ? params->writes : params->comps;
+}
+
+static bool list_has(const bitecs_ComponentsList* list, int comp) {
+    for (unsigned i = 0; i < list->ncomps; ++i) {
+        if (list->components[i] == comp) return true;
+    }
+    return false;
+}
+
+// writer of double-buffered component does not conflict with its readers (they see previous buffer)
+static bool writes_conflict(bitecs_registry* reg, const bitecs_SystemParams* w, const bitecs_SystemParams* r) {
+    const bitecs_ComponentsList* writes = system_writes(w);
+    if (!lists_intersect(writes, r->comps)) return false;
+    for (unsigned i = 0; i < writes->ncomps; ++i) {
+        int comp = writes->components[i];
+        if (!list_has(r->comps, comp)) continue;
+        component_list* list = reg_list(reg, comp);
+        if (!list || !is_double_buffered(list) || list_has(system_writes(r), comp)) return true;
+    }
+    return false;
+}
+
+static bool systems_conflict(bitecs_registry* reg, const bitecs_SystemParams* a, const bitecs_SystemParams* b) {
+    return writes_conflict(reg, a, b) || writes_conflict(reg, b, a);
+}
+
+typedef struct {
+    bitecs_registry* reg;
+    bitecs_SystemParams* params;
+    // systems of current level
+    const size_t* order;
+} RunManyCtx;
+
+static void run_many_task(void* udata, size_t task) {
+    RunManyCtx* ctx = udata;
+    bitecs_system_run(ctx->reg, ctx->params + ctx->order[task]);
+}
+
+bool bitecs_system_run_many(bitecs_registry *registry, bitecs_threadpool *tpool, bitecs_MultiSystemParams *systems)
+{
+    size_t count = systems->nsystems;
+    if (!count) return true;
+    registry_mirror(registry);
+    // systems share entity table: owned before tasks are started
+    if (unlikely(!entities_own(registry))) return false;
+    size_t* levels = mem_alloc(&registry->alloc, sizeof(size_t) * count * 2, bitecs_alloc_temp);
+    if (unlikely(!levels)) return false;
+    size_t* order = levels + count;
+    size_t nlevels = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t level = 0;
+        for (size_t j = 0; j < i; ++j) {
+            if (levels[j] >= level && systems_conflict(registry, systems->params + i, systems->params + j)) {
+                level = levels[j] + 1;
+            }
+        }
+        levels[i] = level;
+        if (level + 1 > nlevels) nlevels = level + 1;
+    }
+    RunManyCtx ctx = {registry, systems->params, order};
+    for (size_t level = 0; level < nlevels; ++level) {
+        size_t n = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (levels[i] == level) order[n++] = i;
+        }
+        bitecs_threadpool_run(tpool, run_many_task, &ctx, n);
+    }
+    mem_free(&registry->alloc, levels, sizeof(size_t) * count * 2, bitecs_alloc_temp);
+    return true;
+}
+
+// sharded world
+
+struct bitecs_world
+{
+    // of first shard (shards outlive world)
+    const bitecs_Allocator* alloc;
+    bitecs_registry** shards;
+    size_t nshards;
+    bitecs_Partition partition;
+    void* partition_udata;
+};
+
+static _Thread_local int current_shard = -1;
+
+static size_t partition_mod(void* udata, uint64_t key, size_t nshards) {
+    (void)udata;
+    return key % nshards;
+}
+
+bitecs_world *bitecs_world_new(bitecs_registry *const *shards, size_t nshards)
+{
+    if (!nshards) return NULL;
+    const bitecs_Allocator* alloc = &shards[0]->alloc;
+    bitecs_world* world = mem_alloc(alloc, sizeof(bitecs_world), bitecs_alloc_registry);
+    if (unlikely(!world)) return NULL;
+    world->alloc = alloc;
+    world->shards = mem_alloc(alloc, sizeof(bitecs_registry*) * nshards, bitecs_alloc_registry);
+    if (unlikely(!world->shards)) {
+        mem_free(alloc, world, sizeof(bitecs_world), bitecs_alloc_registry);
+        return NULL;
+    }
+    memcpy(world->shards, shards, sizeof(bitecs_registry*) * nshards);
+    world->nshards = nshards;
+    world->partition = partition_mod;
+    world->partition_udata = NULL;
+    return world;
+}
+
+void bitecs_world_delete(bitecs_world *world)
+{
+    if (!world) return;
+    const bitecs_Allocator* alloc = world->alloc;
+    mem_free(alloc, world->shards, sizeof(bitecs_registry*) * world->nshards, bitecs_alloc_registry);
+    mem_free(alloc, world, sizeof(bitecs_world), bitecs_alloc_registry);
+}
+
+size_t bitecs_world_shards_count(bitecs_world *world)
+{
+    return world->nshards;
+}
+
+bitecs_registry *bitecs_world_shard(bitecs_world *world, size_t shard)
+{
+    return shard < world->nshards ? world->shards[shard] : NULL;
+}
+
+void bitecs_world_set_partition(bitecs_world *world, bitecs_Partition partition, void *udata)
+{
+    world->partition = partition ? partition : partition_mod;
+    world->partition_udata = udata;
+}
+
+size_t bitecs_world_route(bitecs_world *world, uint64_t key)
+{
+    size_t shard = world->partition(world->partition_udata, key, world->nshards);
+    assert(shard < world->nshards && "Partition returned shard out of range");
+    return shard;
+}
+
+bool bitecs_world_entt_create(
+    bitecs_world *world, uint64_t key, bitecs_index_t count,
+    const bitecs_ComponentsList *components, bitecs_Callback creator, void *udata, uint32_t *outShard)
+{
+    size_t shard = bitecs_world_route(world, key);
+    if (outShard) *outShard = (uint32_t)shard;
+    int was = current_shard;
+    current_shard = (int)shard;
+    bool ok = bitecs_entt_create(world->shards[shard], count, components, creator, udata);
+    current_shard = was;
+    return ok;
+}
+
+typedef struct {
+    bitecs_world* world;
+    bitecs_Task task;
+    void* udata;
+} WorldTaskCtx;
+
+static void world_task(void* udata, size_t shard) {
+    WorldTaskCtx* ctx = udata;
+    int was = current_shard;
+    current_shard = (int)shard;
+    ctx->task(ctx->udata, shard);
+    current_shard = was;
+}
+
+void bitecs_world_run(bitecs_world *world, bitecs_threadpool *tpool, bitecs_Task task, void *udata)
+{
+    WorldTaskCtx ctx = {world, task, udata};
+    bitecs_threadpool_run(tpool, world_task, &ctx, world->nshards);
+}
+
+typedef struct {
+    bitecs_world* world;
+    void* params;
+    _Atomic(bool) failed;
+} WorldSystemCtx;
+
+static void world_system_task(void* udata, size_t shard) {
+    WorldSystemCtx* ctx = udata;
+    bitecs_system_run(ctx->world->shards[shard], ctx->params);
+}
+
+void bitecs_world_system_run(bitecs_world *world, bitecs_threadpool *tpool, bitecs_SystemParams *params)
+{
+    WorldSystemCtx ctx = {world, params, false};
+    bitecs_world_run(world, tpool, world_system_task, &ctx);
+}
+
+static void world_run_many_task(void* udata, size_t shard) {
+    WorldSystemCtx* ctx = udata;
+    if (!bitecs_system_run_many(ctx->world->shards[shard], NULL, ctx->params)) {
+        atomic_store_explicit(&ctx->failed, true, memory_order_relaxed);
+    }
+}
+
+bool bitecs_world_system_run_many(bitecs_world *world, bitecs_threadpool *tpool, bitecs_MultiSystemParams *systems)
+{
+    WorldSystemCtx ctx = {world, systems, false};
+    bitecs_world_run(world, tpool, world_run_many_task, &ctx);
+    return !atomic_load_explicit(&ctx.failed, memory_order_relaxed);
+}
+
+uint64_t bitecs_world_query_count(bitecs_world *world, const bitecs_ComponentsList *comps, bitecs_flags_t flags)
+{
+    uint64_t res = 0;
+    for (size_t i = 0; i < world->nshards; ++i) {
+        res += bitecs_query_count(world->shards[i], comps, flags);
+    }
+    return res;
+}
+
+static void world_cleanup_task(void* udata, size_t shard) {
+    bitecs_registry* reg = ((bitecs_world*)udata)->shards[shard];
+    bitecs_cleanup_data* data = bitecs_cleanup_prepare(reg);
+    if (data) bitecs_cleanup(reg, data);
+}
+
+void bitecs_world_cleanup(bitecs_world *world, bitecs_threadpool *tpool)
+{
+    bitecs_world_run(world, tpool, world_cleanup_task, world);
+}
 
+int bitecs_current_shard(void)
+{
+    return current_shard;
 }
@@ -110,3 +110,37 @@ TEST(Mask, FromToArray){
         CHECK(init[i] == back[i]);
     }
 }
+
+TEST(Mask, Adjust) {
+    int entt[] = {5, 100, 330, 600};
+    int query[] = {100, 600};
+    bitecs_SparseMask emask, qmask;
+    CHECK(bitecs_mask_from_array(&emask, entt, std::size(entt)) == true);
+    CHECK(bitecs_mask_from_array(&qmask, query, std::size(query)) == true);
+    bitecs_Ranks ranks;
+    bitecs_ranks_get(&ranks, qmask.dict);
+    bitecs_mask_t adjusted = bitecs_mask_adjust(qmask.dict, qmask.bits, &ranks, emask.dict);
+    // 100 -> second group, 600 -> fourth group of entt
+    CHECK(adjusted == ((bitecs_mask_t(1) << (16 + 4)) | (bitecs_mask_t(1) << (48 + 8))));
+    CHECK((emask.bits & adjusted) == adjusted);
+    CHECK(bitecs_mask_adjust(qmask.dict, qmask.bits, &ranks, qmask.dict) == qmask.bits);
+}
+
+TEST(Mask, Constexpr) {
+    constexpr std::array<int, 7> init = {100, 101, 120, 200, 202, 204, 600};
+    constexpr bitecs_SparseMask mask = impl::mask_from_sorted(init);
+    bitecs_SparseMask runtime;
+    CHECK(bitecs_mask_from_array(&runtime, init.data(), init.size()) == true);
+    CHECK(mask.dict == runtime.dict);
+    CHECK(mask.bits == runtime.bits);
+
+    constexpr bitecs_Ranks ranks = impl::ranks_get(mask.dict);
+    bitecs_Ranks runtimeRanks;
+    bitecs_ranks_get(&runtimeRanks, runtime.dict);
+    CHECK(ranks.groups_count == runtimeRanks.groups_count);
+    CHECK(ranks.highest_select_mask == runtimeRanks.highest_select_mask);
+    for (int i = 0; i < BITECS_GROUPS_COUNT; ++i) {
+        CHECK(ranks.group_ranks[i] == runtimeRanks.group_ranks[i]);
+        CHECK(ranks.select_dict_masks[i] == runtimeRanks.select_dict_masks[i]);
+    }
+}
@@ -1,5 +1,12 @@
 #include "bitecs/bitecs.hpp"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
 
 using namespace bitecs;
 
@@ -19,6 +26,33 @@ struct Component3 {
     enum {bitecs_id = 1003};
 };
 
+struct Component4 {
+    enum {bitecs_id = 200};
+    int a;
+};
+
+struct Boss {
+    enum {bitecs_id = 404};
+    std::string name;
+};
+
+struct Counted {
+    enum {bitecs_id = 500};
+    static inline int alive = 0;
+    int value = 0;
+    Counted() { alive++; }
+    Counted(const Counted&) { alive++; }
+    Counted(Counted&&) { alive++; }
+    Counted& operator=(const Counted&) = default;
+    ~Counted() { alive--; }
+};
+
+template<int Id>
+struct Marker {
+    enum {bitecs_id = Id};
+    int a;
+};
+
 static const auto counts = {1, 2, 10, 100, 200, 1000, 30000};
 
 #define CHECK ASSERT_TRUE
@@ -66,6 +100,84 @@ TEST(Systems, Basic)
     }
 }
 
+static void CountCallback(bitecs_udata udata, bitecs_CallbackContext*, bitecs_ptrs, bitecs_index_t count) {
+    *static_cast<int*>(udata) += count;
+}
+
+template<typename...Comps>
+static int CountWithCore(Registry& reg) {
+    int res = 0;
+    bitecs_SystemParams params = {};
+    params.comps = &Components<Comps...>::list;
+    params.system = CountCallback;
+    params.udata = &res;
+    bitecs_system_run(reg.Raw(), &params);
+    return res;
+}
+
+TEST(Systems, InlineMatchesCore)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq5);
+    reg.DefineComponent<Component3>(bitecs_freq9);
+    reg.DefineComponent<Component4>(bitecs_freq1);
+    std::vector<EntityPtr> some;
+    for (int i = 0; i < 1000; ++i) {
+        // Component4 lies in group between groups of Component1 and Component2 -> query masks are adjusted
+        (void)reg.Entt(Component1{i}, Component2{});
+        some.push_back(reg.Entt(Component1{i}, Component4{}, Component2{}));
+        (void)reg.Entt(Component4{}, Component3{});
+        (void)reg.Entt(Component1{i}, Component4{}, Component3{});
+    }
+    for (size_t i = 0; i < some.size(); i += 3) {
+        reg.Destroy(some[i]);
+    }
+    int iter = 0;
+    reg.RunSystem([&](Component1& c1, Component2& c2){
+        iter++;
+    });
+    CHECK((iter == CountWithCore<Component1, Component2>(reg)));
+    iter = 0;
+    reg.RunSystem([&](Component1& c1, Component3& c3){
+        iter++;
+    });
+    CHECK(iter == 1000);
+    CHECK((iter == CountWithCore<Component1, Component3>(reg)));
+    iter = 0;
+    reg.RunSystem([&](Component4& c4, Component3& c3){
+        iter++;
+    });
+    CHECK(iter == 2000);
+    CHECK((iter == CountWithCore<Component4, Component3>(reg)));
+    iter = 0;
+    reg.RunSystem<Component1>([&](EntityPtr ptr, Component1& c1){
+        CHECK(reg.GetComponent<Component1>(ptr).a == c1.a);
+        iter++;
+    });
+    CHECK((iter == CountWithCore<Component1>(reg)));
+}
+
+TEST(Systems, MissAfterAdjust)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component4>(bitecs_freq3);
+    reg.DefineComponent<Boss>(bitecs_freq3);
+    reg.DefineComponent<Marker<292>>(bitecs_freq3);
+    reg.DefineComponent<Marker<405>>(bitecs_freq3);
+    // second entt has all groups of adjusted query for first one + one more in the middle,
+    // and bit of Boss lands on bit of Marker<292> if query is adjusted twice
+    (void)reg.Entt(Component1{}, Component4{}, Boss{});
+    (void)reg.Entt(Component1{}, Component4{}, Marker<292>{}, Marker<405>{});
+    CHECK((CountWithCore<Component1, Boss>(reg) == 1));
+    int iter = 0;
+    reg.RunSystem([&](Component1&, Boss&){
+        iter++;
+    });
+    CHECK(iter == 1);
+}
+
 TEST(Entts, MultiCreate) {
     Registry reg;
     reg.DefineComponent<Component1>(bitecs_freq3);
@@ -147,6 +259,146 @@ TEST(Destroy, Basic)
     CHECK(e.generation != e2.generation);
 }
 
+TEST(Placement, Archetype)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq3);
+    std::vector<EntityPtr> entts;
+    // A: [0; 10), B: [10; 20), AB: [20; 30), A: [30; 40), B: [40; 50)
+    for (int i = 0; i < 10; ++i) entts.push_back(reg.Entt(Component1{}));
+    for (int i = 0; i < 10; ++i) entts.push_back(reg.Entt(Component2{}));
+    for (int i = 0; i < 10; ++i) entts.push_back(reg.Entt(Component1{}, Component2{}));
+    for (int i = 0; i < 10; ++i) entts.push_back(reg.Entt(Component1{}));
+    for (int i = 0; i < 10; ++i) entts.push_back(reg.Entt(Component2{}));
+    // hole after A, then hole inside B (first in free list)
+    for (int i = 36; i < 40; ++i) reg.Destroy(entts[i]);
+    for (int i = 14; i < 18; ++i) reg.Destroy(entts[i]);
+    reg.SetPlacement(bitecs_placement_archetype);
+    auto a = reg.Entt(Component1{});
+    CHECK(a.index == 36);
+    auto b = reg.Entt(Component2{});
+    CHECK(b.index == 14);
+    // exact fit of hole, which is not first in free list
+    for (int i = 0; i < 3; ++i) (void)reg.Entt(Component1{});
+    auto stats = reg.Stats();
+    CHECK(stats.free_nodes == 1);
+    CHECK(stats.free_total == 3);
+    int iter = 0;
+    reg.RunSystem([&](Component1&){
+        iter++;
+    });
+    CHECK(iter == 30);
+}
+
+TEST(Destroy, BatchUnsorted)
+{
+    {
+        Registry reg;
+        reg.DefineComponent<Component1>(bitecs_freq3);
+        reg.DefineComponent<Counted>(bitecs_freq1);
+        std::vector<EntityPtr> entts;
+        for (int i = 0; i < 3000; ++i) {
+            entts.push_back(i % 3 ? reg.Entt(Component1{i}, Counted{}) : reg.Entt(Component1{i}));
+        }
+        CHECK(Counted::alive == 2000);
+        reg.Destroy(entts[7]); // stale ptr in batch
+        std::vector<EntityPtr> kill;
+        for (int i = 2999; i >= 0; i -= 2) {
+            kill.push_back(entts[i]);
+        }
+        for (int i = 0; i < 1000; ++i) {
+            kill.push_back(entts[i]); // [0; 1000) fully + duplicates
+        }
+        std::swap(kill[10], kill[1200]);
+        reg.DestroyBatch(kill.data(), kill.size());
+        int iter = 0;
+        reg.RunSystem([&](Component1& c){
+            CHECK(c.a % 2 == 0);
+            CHECK(c.a >= 1000);
+            iter++;
+        });
+        CHECK(iter == 1000);
+        auto stats = reg.Stats();
+        CHECK(stats.entities_live == 1000);
+        CHECK(stats.free_total == 2000);
+        // [0; 1000) coalesced around earlier hole at 7, then odd singles
+        CHECK(stats.free_nodes == 1001);
+        // survivors: even in [1000; 3000) -> 2/3 of them have Counted
+        int counted = 0;
+        for (int i = 1000; i < 3000; i += 2) counted += i % 3 != 0;
+        CHECK(Counted::alive == counted);
+    }
+    CHECK(Counted::alive == 0);
+}
+
+TEST(Destroy, Matching)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq3);
+    int flagged = 0;
+    for (int i = 0; i < 300; ++i) {
+        auto e = i % 3 ? reg.Entt(Component1{i}) : reg.Entt(Component1{i}, Component2{});
+        if (i % 3 && i % 5 == 0) {
+            reg.Deref(e)->flags = 1;
+            flagged++;
+        }
+    }
+    CHECK(reg.DestroyMatching<Component2>() == 100);
+    CHECK(reg.DestroyMatching<>(1) == index_t(flagged));
+    int iter = 0;
+    reg.RunSystem([&](Component1& c){
+        CHECK(c.a % 3 != 0);
+        CHECK(c.a % 5 != 0);
+        iter++;
+    });
+    CHECK(iter == 200 - flagged);
+    auto stats = reg.Stats();
+    CHECK(stats.free_total == 100 + flagged);
+    // flagged entts are next to holes of Component2 ones
+    CHECK(stats.free_nodes == 100);
+    CHECK(stats.components[0].nalives == size_t(iter));
+    CHECK(stats.components[1].nalives == 0);
+}
+
+TEST(Batch, GatherScatter)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq3);
+    std::vector<EntityPtr> entts;
+    for (int i = 0; i < 3000; ++i) {
+        entts.push_back(i % 4 ? reg.Entt(Component1{i, -i}) : reg.Entt(Component1{i, -i}, Component2{}));
+    }
+    for (int i = 0; i < 3000; i += 10) {
+        reg.Destroy(entts[i]);
+    }
+    std::shuffle(entts.begin(), entts.end(), std::minstd_rand(1));
+    for (size_t count: {size_t(10), entts.size()}) {
+        std::vector<Component1> values(count, Component1{-1, -1});
+        CHECK(reg.Gather(entts.data(), count, values.data()) == reg.GetComponents<Component1>(entts.data(), count, std::vector<Component1*>(count).data()));
+        for (size_t i = 0; i < count; ++i) {
+            bool alive = reg.Deref(entts[i]);
+            CHECK(values[i].a == (alive ? int(entts[i].index) : -1));
+            values[i].b = values[i].a * 2;
+        }
+        reg.Scatter(entts.data(), count, values.data());
+        std::vector<Component2*> c2(count);
+        index_t found = reg.GetComponents<Component2>(entts.data(), count, c2.data());
+        index_t expected = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!reg.Deref(entts[i])) continue;
+            CHECK(reg.GetComponent<Component1>(entts[i]).b == int(entts[i].index) * 2);
+            bool has2 = entts[i].index % 4 == 0;
+            expected += has2;
+            CHECK((c2[i] != nullptr) == has2);
+            if (has2) CHECK(c2[i] == &reg.GetComponent<Component2>(entts[i]));
+        }
+        CHECK(found == expected);
+    }
+}
+
 TEST(Cleanup, Basic)
 {
     Registry reg;
@@ -160,6 +412,220 @@ TEST(Cleanup, Basic)
     reg.Cleanup(data2);
 }
 
+TEST(Frequency, Rechunk)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq9);
+    reg.DefineComponent<Component2>(bitecs_freq1);
+    std::vector<EntityPtr> ones;
+    for (int i = 0; i < 5000; ++i) {
+        if (i % 100 == 0) {
+            ones.push_back(reg.Entt(Component1{i, i * 2}, Component2{}));
+        } else {
+            (void)reg.Entt(Component2{});
+        }
+    }
+    auto stats = reg.Stats<Component1>();
+    CHECK(stats.nalives == ones.size());
+    CHECK(stats.nchunks == 1);
+    CHECK(stats.capacity > stats.nalives * 100);
+    CHECK(bitecs_component_suggest_frequency(reg.Raw(), component_id<Component1>) < bitecs_freq9);
+    CHECK(bitecs_component_suggest_frequency(reg.Raw(), component_id<Component2>) > bitecs_freq1);
+
+    reg.Rechunk<Component1>(bitecs_freq1);
+    reg.Rechunk<Component2>(bitecs_freq9);
+    stats = reg.Stats<Component1>();
+    CHECK(stats.nalives == ones.size());
+    CHECK(stats.nchunks == ones.size());
+    for (int i = 0; i < ones.size(); ++i) {
+        auto& c1 = reg.GetComponent<Component1>(ones[i]);
+        CHECK(c1.a == i * 100);
+        CHECK(c1.b == i * 200);
+    }
+    int iter = 0;
+    reg.RunSystem([&](Component1& c1, Component2& c2){
+        iter++;
+    });
+    CHECK(iter == ones.size());
+    CHECK(reg.Stats<Component2>().nalives == 5000);
+}
+
+TEST(Frequency, Auto)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq9, true);
+    for (int i = 0; i < 10; ++i) {
+        (void)reg.Entt(Component1{i});
+    }
+    reg.Cleanup(reg.PrepareCleanup());
+    auto stats = reg.Stats<Component1>();
+    CHECK(stats.frequency < bitecs_freq9);
+    CHECK(stats.nalives == 10);
+    int sum = 0;
+    reg.RunSystem([&](Component1& c1){
+        sum += c1.a;
+    });
+    CHECK(sum == 45);
+}
+
+TEST(Frequency, RechunkBeforeCleanup)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq1);
+    std::vector<EntityPtr> entts;
+    for (int i = 0; i < 640; ++i) {
+        entts.push_back(reg.Entt(Component1{i, 1}));
+    }
+    for (int i = 0; i < 320; ++i) reg.Destroy(entts[i]);
+    auto data = reg.PrepareCleanup();
+    // chunk indices in data are stale after that (and refilled chunk is not empty anymore)
+    reg.Rechunk<Component1>(bitecs_freq9);
+    (void)reg.Entt(Component1{0, 1});
+    reg.Cleanup(data);
+    CHECK(reg.Stats<Component1>().nalives == 321);
+    int sum = 0;
+    int count = 0;
+    reg.RunSystem([&](Component1& c1){
+        sum += c1.a;
+        count += c1.b;
+    });
+    CHECK(count == 321);
+    CHECK(sum == (320 + 639) * 320 / 2);
+}
+
+TEST(Sparse, Basic)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq9);
+    reg.DefineSparseComponent<Boss>();
+    std::vector<EntityPtr> bosses;
+    for (int i = 0; i < 100'000; ++i) {
+        if (i % 1000 == 999) {
+            bosses.push_back(reg.Entt(Component1{i}, Boss{"boss " + std::to_string(i)}));
+        } else {
+            (void)reg.Entt(Component1{i});
+        }
+    }
+    reg.Entts<Component1, Boss>(10, [&](EntityPtr ptr, Component1& c1, Boss& boss){
+        c1.a = ptr.index;
+        boss.name = "boss " + std::to_string(ptr.index);
+        bosses.push_back(ptr);
+    });
+    CHECK(reg.Stats<Boss>().nalives == bosses.size());
+    CHECK(reg.Stats<Boss>().nchunks == 0);
+    for (auto boss: bosses) {
+        CHECK(reg.GetComponent<Boss>(boss).name == "boss " + std::to_string(boss.index));
+    }
+    int iter = 0;
+    reg.RunSystem([&](Component1& c1, Boss& boss){
+        CHECK(boss.name == "boss " + std::to_string(c1.a));
+        iter++;
+    });
+    CHECK(iter == bosses.size());
+
+    // swap-removal must keep lookups valid
+    reg.RemoveComponent<Boss>(bosses[0]);
+    reg.Destroy(bosses[50]);
+    reg.Destroy(bosses[bosses.size() - 5]);
+    CHECK(reg.Stats<Boss>().nalives == bosses.size() - 3);
+    for (size_t i = 1; i < bosses.size(); ++i) {
+        if (i == 50 || i == bosses.size() - 5) continue;
+        CHECK(reg.GetComponent<Boss>(bosses[i]).name == "boss " + std::to_string(bosses[i].index));
+    }
+    reg.AddComponent<Boss>(bosses[0], Boss{"again"});
+    CHECK(reg.GetComponent<Boss>(bosses[0]).name == "again");
+    iter = 0;
+    reg.RunSystem([&](Boss& boss){
+        iter++;
+    });
+    CHECK(iter == bosses.size() - 2);
+}
+
+TEST(Sparse, Merge)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineSparseComponent<Boss>();
+    Registry reg2;
+    reg2.DefineComponent<Component1>(bitecs_freq3);
+    reg2.DefineSparseComponent<Boss>();
+    (void)reg.Entt(Component1{}, Boss{"first"});
+    (void)reg2.Entt(Component1{});
+    (void)reg2.Entt(Boss{"second"});
+    reg.MergeFrom(reg2);
+    std::vector<std::string> names;
+    reg.RunSystem([&](Boss& boss){
+        names.push_back(boss.name);
+    });
+    CHECK(names.size() == 2);
+    CHECK(names[0] == "first");
+    CHECK(names[1] == "second");
+}
+
+TEST(Stats, Registry)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq5);
+    reg.DefineSparseComponent<Boss>();
+    std::vector<EntityPtr> entts;
+    for (int i = 0; i < 100; ++i) {
+        entts.push_back(reg.Entt(Component1{}, Component2{}));
+        entts.push_back(reg.Entt(Component1{}));
+    }
+    (void)reg.Entt(Boss{"boss"});
+    reg.Destroy(entts[10]);
+    reg.Destroy(entts[11]);
+    reg.Destroy(entts[50]);
+    auto stats = reg.Stats();
+    CHECK(stats.entities_live == 198);
+    CHECK(stats.entities_dead == 3);
+    CHECK(stats.entities_cap >= 201);
+    CHECK(stats.free_nodes == 2);
+    CHECK(stats.free_largest == 2);
+    CHECK(stats.free_total == 3);
+    CHECK(stats.ncomponents == 3);
+    CHECK(stats.components[0].id == component_id<Component1>);
+    CHECK(stats.components[0].nalives == 197);
+    CHECK(stats.components[1].nalives == 98);
+    CHECK(stats.components[2].nalives == 1);
+    CHECK(stats.narchetypes == 3);
+    CHECK(stats.archetypes[0].count == 99);
+    CHECK(stats.archetypes[1].count == 98);
+    CHECK(stats.archetypes[2].count == 1);
+    CHECK(stats.bytes_total > stats.components[0].bytes + stats.components[1].bytes);
+}
+
+#ifdef BITECS_PROFILE
+TEST(Profile, Traces)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq5);
+    reg.EnableProfiling(4);
+    for (int i = 0; i < 1000; ++i) {
+        (void)reg.Entt(Component1{}, Component2{});
+        (void)reg.Entt(Component1{});
+    }
+    for (int i = 0; i < 5; ++i) {
+        reg.RunSystem([](Component1&, Component2&){});
+    }
+    bitecs_SystemTrace traces[8];
+    size_t count = bitecs_profile_read(reg.Raw(), traces, 8);
+    CHECK(count == 4);
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(traces[i].scanned == 2000);
+        CHECK(traces[i].matched == 1000);
+        CHECK(traces[i].runs == 1000);
+        CHECK(traces[i].end_ns >= traces[i].begin_ns);
+        CHECK(traces[i].name != nullptr);
+    }
+    std::string path = testing::TempDir() + "bitecs_test_trace.json";
+    CHECK(bitecs_profile_export_chrome(reg.Raw(), path.c_str()));
+    std::remove(path.c_str());
+}
+#endif
+
 TEST(Merge, Basic)
 {
     Registry reg;
@@ -204,4 +670,668 @@ TEST(Merge, Basic)
 }
 
 
+TEST(Mapped, Basic)
+{
+    std::string path = testing::TempDir() + "bitecs_mapped.bin";
+    std::remove(path.c_str());
+    EntityPtr last;
+    {
+        Registry reg = Registry::Mapped(path.c_str(), size_t(64) << 20);
+        reg.DefineComponent<Component1>(bitecs_freq3);
+        reg.DefineComponent<Component2>(bitecs_freq5);
+        std::vector<EntityPtr> entts;
+        for (int i = 0; i < 10000; ++i) {
+            entts.push_back(reg.Entt(Component1{i, -i}, Component2{double(i), 0}));
+        }
+        // empty whole chunks in the middle, so they are returned to file
+        for (int i = 1000; i < 5000; ++i) reg.Destroy(entts[i]);
+        reg.Cleanup(reg.PrepareCleanup());
+        CHECK(reg.Stats<Component1>().chunk_frees > 0);
+        reg.Rechunk<Component2>(bitecs_freq7);
+        for (int i = 0; i < 4000; ++i) (void)reg.Entt(Component1{1, 1});
+        int64_t sum = 0;
+        int count = 0;
+        reg.RunSystem([&](Component1& c1, Component2& c2){
+            CHECK(c1.a == int(c2.a));
+            sum += c1.b;
+            count++;
+        });
+        CHECK(count == 6000);
+        CHECK(sum == -(int64_t(999) * 1000 / 2 + int64_t(5000 + 9999) * 5000 / 2));
+        last = entts.back();
+    }
+    // existing file is not overwritten
+    EXPECT_THROW(Registry::Mapped(path.c_str(), size_t(64) << 20), std::runtime_error);
+    for (int restart = 0; restart < 2; ++restart) {
+        Registry reg = Registry::OpenMapped(path.c_str());
+        // handles stay valid after restart
+        if (restart == 0) reg.Destroy(last);
+        int64_t sum = 0;
+        int count = 0;
+        reg.RunSystem([&](Component1& c1, Component2& c2){
+            CHECK(c1.a == int(c2.a));
+            sum += c1.b;
+            count++;
+        });
+        CHECK(count == 5999);
+        CHECK(sum == -(int64_t(999) * 1000 / 2 + int64_t(5000 + 9998) * 4999 / 2));
+        int plain = 0;
+        reg.RunSystem([&](Component1& c1){ plain += c1.a == 1 && c1.b == 1; });
+        CHECK(plain == 4000 + restart * 100);
+        for (int i = 0; i < 100; ++i) (void)reg.Entt(Component1{1, 1});
+    }
+    // not closed cleanly: reopen is refused until bitecs_registry_delete()
+    bitecs_registry* open = bitecs_registry_open_mapped(path.c_str());
+    CHECK(open != nullptr);
+    CHECK(bitecs_registry_open_mapped(path.c_str()) == nullptr);
+    bitecs_registry_delete(open);
+    std::remove(path.c_str());
+    EXPECT_THROW(Registry::Mapped("/nonexistent/dir/file", 1 << 20), std::runtime_error);
+    EXPECT_THROW(Registry::OpenMapped(path.c_str()), std::runtime_error);
+}
+
+
+struct CountingAllocator {
+    size_t live[bitecs_alloc_temp + 1] = {};
+    size_t calls[bitecs_alloc_temp + 1] = {};
+    bool misaligned = false;
+
+    bitecs_Allocator Get() {
+        return {
+            [](void* udata, size_t size, size_t align, bitecs_AllocKind kind) -> void* {
+                auto self = static_cast<CountingAllocator*>(udata);
+                void* res = bitecs_allocator_default()->alloc(nullptr, size, align, kind);
+                if (reinterpret_cast<uintptr_t>(res) % align) self->misaligned = true;
+                self->live[kind] += size;
+                self->calls[kind]++;
+                return res;
+            },
+            [](void* udata, void* ptr, size_t size, size_t align, bitecs_AllocKind kind) {
+                static_cast<CountingAllocator*>(udata)->live[kind] -= size;
+                bitecs_allocator_default()->free(nullptr, ptr, size, align, kind);
+            },
+            this
+        };
+    }
+};
+
+TEST(Allocator, Custom)
+{
+    CountingAllocator counter;
+    {
+        Registry reg(counter.Get());
+        reg.DefineComponent<Component1>(bitecs_freq3);
+        reg.DefineSparseComponent<Component2>();
+        std::vector<EntityPtr> entts;
+        for (int i = 0; i < 1000; ++i) {
+            entts.push_back(i % 3 ? reg.Entt(Component1{i, i}) : reg.Entt(Component1{i, i}, Component2{}));
+        }
+        for (int i = 100; i < 600; i += 2) reg.Destroy(entts[i]);
+        reg.Cleanup(reg.PrepareCleanup());
+        reg.Rechunk<Component1>(bitecs_freq5);
+        int iter = 0;
+        reg.RunSystem([&](Component1& c1){
+            iter++;
+        });
+        CHECK(iter == 750);
+        for (auto kind: {bitecs_alloc_registry, bitecs_alloc_chunk, bitecs_alloc_entities, bitecs_alloc_index, bitecs_alloc_temp}) {
+            CHECK(counter.calls[kind] > 0);
+        }
+        CHECK(!counter.misaligned);
+    }
+    for (size_t live: counter.live) {
+        CHECK(live == 0);
+    }
+    bitecs_Allocator numa;
+    if (bitecs_allocator_numa(&numa, -1)) {
+        Registry reg(numa);
+        reg.DefineComponent<Component1>(bitecs_freq9);
+        std::vector<EntityPtr> entts;
+        for (int i = 0; i < 50000; ++i) entts.push_back(reg.Entt(Component1{i, i}));
+        // freed chunks are reused from slab
+        for (int i = 0; i < 40000; ++i) reg.Destroy(entts[size_t(i)]);
+        reg.Cleanup(reg.PrepareCleanup());
+        for (int i = 0; i < 40000; ++i) (void)reg.Entt(Component1{i, i});
+        int64_t sum = 0;
+        reg.RunSystem([&](Component1& c1){
+            sum += c1.a;
+        });
+        CHECK(sum == int64_t(49999) * 50000 / 2);
+    }
+}
+
+TEST(Schedule, Levels)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>();
+    reg.DefineComponent<Component2>();
+    reg.DefineComponent<Component4>();
+    for (int i = 0; i < 1000; ++i) {
+        (void)reg.Entt(Component1{i, i * 2}, Component2{}, Component4{});
+    }
+    ThreadPool pool(3);
+    auto graph = reg.Schedule()
+        .Add([](const Component1& c1, Component2& c2){ c2.a = c1.a; })
+        .Add([](const Component1& c1, Component4& c4){ c4.a = c1.b; })
+        .Add([](const Component2& c2, Component4& c4){ c4.a += int(c2.a); })
+        .Add([](Component1& c1){ c1.b++; });
+    using Graph = decltype(graph);
+    static_assert(Graph::LevelsCount() == 2);
+    static_assert(Graph::Level(0) == 0 && Graph::Level(1) == 0);
+    static_assert(Graph::Level(2) == 1 && Graph::Level(3) == 1);
+    graph.Run(pool);
+    graph.Run(pool);
+    int checked = 0;
+    reg.RunSystem([&](Component1& c1, Component2& c2, Component4& c4){
+        CHECK(c1.b == c1.a * 2 + 2);
+        CHECK(int(c2.a) == c1.a);
+        CHECK(c4.a == c1.a * 3 + 1);
+        checked++;
+    });
+    CHECK(checked == 1000);
+    EXPECT_THROW(reg.Schedule().Add([](Component1&){ throw std::runtime_error("fail"); }).Run(pool), std::runtime_error);
+}
+
+TEST(Schedule, RunMany)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>();
+    reg.DefineComponent<Component2>();
+    for (int i = 0; i < 1000; ++i) {
+        (void)reg.Entt(Component1{i, 0}, Component2{});
+    }
+    ThreadPool pool(2);
+    // first two only read Component1 -> same level, last one writes it
+    std::atomic<int> seen[3] = {};
+    auto count = [](bitecs_udata udata, bitecs_CallbackContext*, bitecs_ptrs, bitecs_index_t n) {
+        *static_cast<std::atomic<int>*>(udata) += int(n);
+    };
+    bitecs_SystemParams params[3] = {};
+    params[0].comps = &Components<Component1>::list;
+    params[0].writes = &Components<>::list;
+    params[1].comps = &Components<Component1, Component2>::list;
+    params[1].writes = &Components<Component2>::list;
+    params[2].comps = &Components<Component1>::list;
+    for (int i = 0; i < 3; ++i) {
+        params[i].system = count;
+        params[i].udata = seen + i;
+    }
+    bitecs_MultiSystemParams many = {params, 3};
+    CHECK(bitecs_system_run_many(reg.Raw(), pool.Raw(), &many));
+    for (auto& n: seen) {
+        CHECK(n == 1000);
+    }
+}
+
+TEST(Query, Pull)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq1);
+    reg.DefineComponent<Component2>(bitecs_freq3);
+    for (int i = 0; i < 500; ++i) {
+        if (i % 7) {
+            (void)reg.Entt(Component1{i, 0}, Component2{double(i), 0});
+        } else {
+            (void)reg.Entt(Component1{i, 0});
+        }
+    }
+    // Component2 first in list -> ptrs are in order of list
+    auto& list = Components<Component2, Component1>::list;
+    bitecs_query* query = bitecs_query_begin(reg.Raw(), &list, 0, nullptr);
+    CHECK(query);
+    bitecs_QueryBatch batch;
+    int seen = 0;
+    int batches = 0;
+    while (bitecs_query_next(query, &batch)) {
+        auto* c2 = static_cast<Component2*>(batch.ptrs[0]);
+        auto* c1 = static_cast<Component1*>(batch.ptrs[1]);
+        for (bitecs_index_t i = 0; i < batch.count; ++i) {
+            CHECK(c1[i].a == int(batch.index + i));
+            CHECK(int(c2[i].a) == c1[i].a);
+        }
+        seen += batch.count;
+        batches++;
+        if (batches == 3) {
+            // created entts are visited
+            for (int i = 0; i < 10; ++i) (void)reg.Entt(Component1{500 + i, 0}, Component2{double(500 + i), 0});
+        }
+    }
+    bitecs_query_end(query);
+    CHECK(seen == 500 - 72 + 10);
+    CHECK(batches > 3);
+    // early stop
+    query = bitecs_query_begin(reg.Raw(), &list, 0, nullptr);
+    CHECK(bitecs_query_next(query, &batch));
+    CHECK(batch.index == 1);
+    bitecs_query_end(query);
+}
+
+TEST(Query, CountCollect)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>();
+    reg.DefineComponent<Component2>();
+    reg.DefineComponent<Component3>();
+    std::vector<EntityPtr> expected;
+    std::vector<EntityPtr> all;
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 3 == 0) {
+            all.push_back(reg.Entt(Component1{}, Component2{}));
+        } else if (i % 3 == 1) {
+            // extra group below Component2 -> adjusted query
+            all.push_back(reg.Entt(Component1{}, Component2{}, Component3{}));
+        } else {
+            all.push_back(reg.Entt(Component1{}));
+            continue;
+        }
+        if (i % 5 == 0) {
+            reg.Destroy(all.back());
+        } else {
+            expected.push_back(all.back());
+        }
+    }
+    int iter = 0;
+    reg.RunSystem([&](Component1&, Component2&){
+        iter++;
+    });
+    index_t count = reg.Count<Component1, Component2>();
+    CHECK(count == expected.size());
+    CHECK(int(expected.size()) == iter);
+    CHECK(reg.Count<Component3>() == 267);
+    CHECK(reg.Count<Component1>() == 867);
+    std::vector<EntityPtr> out(expected.size());
+    index_t collected = reg.Collect<Component1, Component2>(out.data(), out.size());
+    CHECK(collected == expected.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+        CHECK(out[i].index == expected[i].index);
+        CHECK(out[i].generation == expected[i].generation);
+    }
+    // short buffer: total is still reported
+    EntityPtr few[10];
+    collected = reg.Collect<Component1, Component2>(few, 10);
+    CHECK(collected == expected.size());
+    CHECK(few[9].index == expected[9].index);
+}
+
+TEST(Resumable, Budget)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    reg.DefineComponent<Component2>(bitecs_freq3);
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 10) {
+            (void)reg.Entt(Component1{i, 0});
+        } else {
+            (void)reg.Entt(Component2{});
+        }
+    }
+    auto sys = reg.Resumable([](Component1& c1){
+        c1.b++;
+    });
+    int slices = 0;
+    while (!sys.Resume(100)) {
+        slices++;
+        if (slices == 2) {
+            CHECK(sys.Cursor() < 300);
+            // appended entts are picked up by unfinished run
+            for (int i = 0; i < 50; ++i) (void)reg.Entt(Component1{1000 + i, 0});
+        }
+    }
+    CHECK(slices == 9);
+    int processed = 0;
+    reg.RunSystem([&](Component1& c1){
+        CHECK(c1.b == 1);
+        processed++;
+    });
+    CHECK(processed == 950);
+    sys.Restart();
+    CHECK(sys.Resume(0));
+    reg.RunSystem([&](Component1& c1){
+        CHECK(c1.b == 2);
+    });
+    // 1ns budget: one batch (up to chunk end) per slice
+    sys.Restart();
+    slices = 0;
+    while (!sys.Resume(0, 1)) slices++;
+    CHECK(slices >= 3);
+}
+
+TEST(Resumable, DestroyBetweenSlices)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    std::vector<EntityPtr> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs.push_back(reg.Entt(Component1{i, 0}));
+    }
+    static int processed;
+    processed = 0;
+    auto sys = reg.Resumable([](Component1& c1){
+        c1.b++;
+        processed++;
+    });
+    CHECK(!sys.Resume(100));
+    // rest of current run is gone, whole chunk (256..511) is freed
+    for (size_t i = 150; i < 600; ++i) reg.Destroy(ptrs[i]);
+    reg.Cleanup(reg.PrepareCleanup());
+    while (!sys.Resume(100)) {}
+    CHECK(processed == 550);
+    reg.RunSystem([](Component1& c1){
+        CHECK(c1.b == 1);
+    });
+}
+
+TEST(Transfer, Basic)
+{
+    Counted::alive = 0;
+    {
+        Registry src;
+        Registry dst;
+        for (Registry* reg: {&src, &dst}) {
+            reg->DefineComponent<Component1>(bitecs_freq3);
+            reg->DefineComponent<Boss>(bitecs_freq3);
+            reg->DefineComponent<Counted>(bitecs_freq3);
+        }
+        (void)dst.Entt(Component1{-1, 0});
+        std::vector<EntityPtr> ptrs;
+        for (int i = 0; i < 100; ++i) {
+            if (i % 3) {
+                ptrs.push_back(src.Entt(Component1{i, 0}, Boss{"boss" + std::to_string(i)}));
+            } else {
+                ptrs.push_back(src.Entt(Component1{i, 0}, Counted{}));
+            }
+        }
+        src.Destroy(ptrs[5]);
+        std::vector<EntityPtr> moving(ptrs.begin(), ptrs.begin() + 50);
+        moving.push_back(ptrs[10]); // duplicate
+        std::vector<EntityPtr> out(moving.size());
+        CHECK(src.TransferTo(dst, moving.data(), moving.size(), out.data()) == 49);
+        CHECK(out[5].index == index_t(-1));
+        CHECK(out[50].index == index_t(-1));
+        CHECK(src.Count<Component1>() == 50);
+        CHECK(dst.Count<Component1>() == 50);
+        CHECK(dst.Count<Counted>() == 17);
+        CHECK(Counted::alive == 34);
+        for (int i = 0; i < 50; ++i) {
+            if (i == 5) continue;
+            CHECK(!src.Deref(ptrs[i]));
+            CHECK(dst.GetComponent<Component1>(out[i]).a == i);
+            if (i % 3) {
+                CHECK(dst.GetComponent<Boss>(out[i]).name == "boss" + std::to_string(i));
+            }
+        }
+        CHECK(src.GetComponent<Component1>(ptrs[70]).a == 70);
+    }
+    CHECK(Counted::alive == 0);
+}
+
+TEST(Fork, CopyOnWrite)
+{
+    Counted::alive = 0;
+    {
+        std::optional<Registry> parent;
+        Registry& reg = parent.emplace();
+        reg.DefineComponent<Component1>(bitecs_freq3);
+        reg.DefineComponent<Boss>(bitecs_freq3);
+        reg.DefineComponent<Counted>(bitecs_freq3);
+        std::vector<EntityPtr> ptrs;
+        for (int i = 0; i < 1000; ++i) {
+            ptrs.push_back(reg.Entt(Component1{i, 0}, Boss{"boss"}, Counted{}));
+        }
+        Registry fork = reg.Fork();
+        fork.RunSystem([](Component1& c1, const Boss&){
+            c1.b = 1;
+        });
+        fork.GetComponent<Boss>(ptrs[10]).name = "forked";
+        fork.Destroy(ptrs[20]);
+        (void)fork.Entt(Component1{-1, 0});
+        reg.GetComponent<Component1>(ptrs[30]).a = -30;
+        int seen = 0;
+        reg.RunSystem([&](Component1& c1, Boss& boss){
+            CHECK(c1.b == 0);
+            CHECK(boss.name == "boss");
+            seen++;
+        });
+        CHECK(seen == 1000);
+        CHECK(fork.GetComponent<Boss>(ptrs[10]).name == "forked");
+        CHECK(fork.GetComponent<Component1>(ptrs[30]).a == 30);
+        CHECK(!fork.Deref(ptrs[20]));
+        CHECK(fork.Count<Component1>() == 1000);
+        // parent goes away first: fork keeps shared chunks alive
+        parent.reset();
+        seen = 0;
+        fork.RunSystem([&](const Component1& c1, const Counted&){
+            CHECK(c1.b == 1);
+            seen++;
+        });
+        CHECK(seen == 999);
+    }
+    CHECK(Counted::alive == 0);
+}
+
+TEST(Fork, EntityFlags)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq3);
+    std::vector<EntityPtr> ptrs;
+    for (int i = 0; i < 100; ++i) ptrs.push_back(reg.Entt(Component1{i, 0}));
+    // header-only loop, C system and pull query hand out writable proxies
+    Registry inlined = reg.Fork();
+    inlined.RunSystem<Component1>([](EntityProxy* e, Component1&){
+        e->flags = 7;
+    });
+    Registry system = reg.Fork();
+    bitecs_SystemParams params = {};
+    params.comps = &Components<Component1>::list;
+    params.system = [](bitecs_udata, bitecs_CallbackContext* ctx, bitecs_ptrs, bitecs_index_t n) {
+        for (bitecs_index_t i = 0; i < n; ++i) ctx->entts[i].flags = 7;
+    };
+    bitecs_system_run(system.Raw(), &params);
+    Registry pulled = reg.Fork();
+    bitecs_query* query = bitecs_query_begin(pulled.Raw(), &Components<Component1>::list, 0, nullptr);
+    CHECK(query);
+    bitecs_QueryBatch batch;
+    while (bitecs_query_next(query, &batch)) {
+        for (bitecs_index_t i = 0; i < batch.count; ++i) batch.entts[i].flags = 7;
+    }
+    bitecs_query_end(query);
+    for (Registry* fork: {&inlined, &system, &pulled}) {
+        CHECK(fork->Deref(ptrs[50])->flags == 7);
+    }
+    for (auto ptr: ptrs) {
+        CHECK(reg.Deref(ptr)->flags == 0);
+    }
+}
+
+TEST(World, Sharded)
+{
+    Schema schema;
+    CHECK(schema.DefineComponent<Component1>(bitecs_freq3));
+    CHECK(schema.DefineComponent<Component2>(bitecs_freq3));
+    World world(schema, 4);
+    for (size_t shard = 0; shard < world.ShardsCount(); ++shard) {
+        CHECK(bitecs_registry_schema(world.Shard(shard).Raw()) == schema.Raw());
+    }
+    std::vector<ShardPtr> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs.push_back(world.Entt(uint64_t(i), Component1{i, 0}));
+    }
+    (void)world.Entt(1, Component2{});
+    for (size_t shard = 0; shard < world.ShardsCount(); ++shard) {
+        CHECK(world.Shard(shard).Count<Component1>() == 250);
+    }
+    CHECK(world.Count<Component1>() == 1000);
+    CHECK(world.Count<Component2>() == 1);
+    ThreadPool pool(2);
+    std::atomic<int> visited[4] = {};
+    world.RunSystem(pool, [&](Component1& c1){
+        c1.b = bitecs_current_shard();
+        visited[bitecs_current_shard()]++;
+    });
+    for (auto& v: visited) {
+        CHECK(v == 250);
+    }
+    CHECK(bitecs_current_shard() == -1);
+    CHECK(ptrs[7].shard == 3);
+    CHECK(world.GetComponent<Component1>(ptrs[7]).a == 7);
+    CHECK(world.GetComponent<Component1>(ptrs[7]).b == 3);
+    world.Destroy(ptrs[7]);
+    world.Cleanup(pool.Raw());
+    CHECK(world.Count<Component1>() == 999);
+}
+
+TEST(Schema, Shared)
+{
+    Schema schema;
+    CHECK(schema.DefineComponent<Component1>(bitecs_freq3));
+    CHECK(schema.DefineComponent<Boss>());
+    std::vector<Registry> rooms;
+    for (int i = 0; i < 100; ++i) {
+        rooms.emplace_back(schema);
+    }
+    // immutable, once shared
+    CHECK(!schema.DefineComponent<Component2>());
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j <= i % 3; ++j) {
+            (void)rooms[size_t(i)].Entt(Component1{i, j});
+        }
+    }
+    (void)rooms[5].Entt(Boss{"five"});
+    CHECK(rooms[5].Count<Boss>() == 1);
+    CHECK(rooms[6].Count<Boss>() == 0);
+    // define in one room copies schema, others do not see it
+    CHECK(rooms[7].DefineComponent<Component2>());
+    CHECK(!rooms[7].DefineComponent<Component1>());
+    (void)rooms[7].Entt(Component1{}, Component2{});
+    auto both = rooms[7].Count<Component1, Component2>();
+    CHECK(both == 1);
+    CHECK(rooms[7].Raw() != nullptr && bitecs_registry_schema(rooms[7].Raw()) != schema.Raw());
+    CHECK(bitecs_registry_schema(rooms[8].Raw()) == schema.Raw());
+    auto& room = rooms[2];
+    CHECK(room.Count<Component1>() == 3);
+    bitecs_RegistryStats stats;
+    CHECK(bitecs_registry_stats(room.Raw(), &stats));
+    CHECK(stats.ncomponents == 2);
+    bitecs_registry_stats_free(&stats);
+    // background load into registry with same schema
+    Registry loaded(schema);
+    (void)loaded.Entt(Component1{1000, 0});
+    CHECK(bitecs_registry_merge_other(room.Raw(), loaded.Raw()));
+    CHECK(room.Count<Component1>() == 4);
+}
+
+TEST(DoubleBuffer, ParallelReadWrite)
+{
+    using Pos = Marker<600>;
+    Registry reg;
+    CHECK(reg.DefineDoubleBufferedComponent<Pos>(bitecs_freq3));
+    reg.DefineComponent<Component1>();
+    std::vector<EntityPtr> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+        ptrs.push_back(reg.Entt(Pos{i}, Component1{}));
+    }
+    // writer and reader of Pos must meet inside of first batch -> they run in parallel
+    struct Ctx {
+        std::atomic<int> arrived{0};
+        bool met = false;
+    };
+    static Ctx ctx;
+    static const auto rendezvous = []{
+        if (ctx.arrived++ >= 2) return;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (ctx.arrived < 2 && std::chrono::steady_clock::now() < deadline) {}
+        ctx.met |= ctx.arrived >= 2;
+    };
+    bitecs_SystemParams params[2] = {};
+    params[0].comps = &Components<Pos>::list;
+    params[0].system = [](bitecs_udata, bitecs_CallbackContext*, bitecs_ptrs ptrs, bitecs_index_t n) {
+        rendezvous();
+        auto* pos = static_cast<Pos*>(ptrs[0]);
+        for (bitecs_index_t i = 0; i < n; ++i) pos[i].a++;
+    };
+    params[1].comps = &Components<Pos, Component1>::list;
+    params[1].writes = &Components<Component1>::list;
+    params[1].system = [](bitecs_udata, bitecs_CallbackContext*, bitecs_ptrs ptrs, bitecs_index_t n) {
+        rendezvous();
+        auto* pos = static_cast<const Pos*>(ptrs[0]);
+        auto* c1 = static_cast<Component1*>(ptrs[1]);
+        for (bitecs_index_t i = 0; i < n; ++i) c1[i].a = pos[i].a;
+    };
+    bitecs_MultiSystemParams many = {params, 2};
+    ThreadPool pool(2);
+    for (int frame = 0; frame < 3; ++frame) {
+        CHECK(bitecs_system_run_many(reg.Raw(), pool.Raw(), &many));
+        for (int i = 0; i < 1000; i += 99) {
+            auto entt = ptrs[size_t(i)];
+            CHECK(reg.GetComponent<Component1>(entt).a == i + frame);
+            CHECK(reg.ReadComponent<Pos>(entt).a == i + frame);
+            CHECK(reg.GetComponent<Pos>(entt).a == i + frame + 1);
+        }
+        reg.SwapBuffers<Pos>();
+        CHECK(reg.ReadComponent<Pos>(ptrs[5]).a == 5 + frame + 1);
+    }
+    CHECK(ctx.met);
+    // new entt in written chunk: previous value is the initial one, neighbours keep theirs
+    auto bare = reg.Entt(Component1{});
+    CHECK(bitecs_system_run_many(reg.Raw(), pool.Raw(), &many));
+    auto late = reg.Entt(Pos{-1});
+    reg.AddComponent<Pos>(bare, Pos{-2});
+    CHECK(reg.ReadComponent<Pos>(late).a == -1);
+    CHECK(reg.ReadComponent<Pos>(bare).a == -2);
+    CHECK(reg.GetComponent<Pos>(bare).a == -2);
+    CHECK(reg.ReadComponent<Pos>(ptrs[999]).a == 999 + 3);
+    CHECK(reg.ReadComponent<Pos>(ptrs[0]).a == 3);
+    reg.Destroy(ptrs[0]);
+    reg.SwapBuffers<Pos>();
+    CHECK(reg.ReadComponent<Pos>(ptrs[1]).a == 1 + 4);
+    // mutable access outside of systems writes next buffer as well
+    reg.GetComponent<Pos>(ptrs[2]).a = 100;
+    CHECK(reg.ReadComponent<Pos>(ptrs[2]).a == 2 + 4);
+    Pos scattered{200};
+    CHECK(reg.Scatter<Pos>(&ptrs[3], 1, &scattered) == 1);
+    CHECK(reg.ReadComponent<Pos>(ptrs[3]).a == 3 + 4);
+    reg.SwapBuffers<Pos>();
+    CHECK(reg.ReadComponent<Pos>(ptrs[2]).a == 100);
+    CHECK(reg.ReadComponent<Pos>(ptrs[3]).a == 200);
+    // read-only pull query sees previous buffer
+    reg.GetComponent<Pos>(ptrs[2]).a = 300;
+    bitecs_query* query = bitecs_query_begin(
+        reg.Raw(), &Components<Pos, Component1>::list, 0, &Components<Component1>::list);
+    CHECK(query);
+    bitecs_QueryBatch batch;
+    bool found = false;
+    while (bitecs_query_next(query, &batch)) {
+        for (bitecs_index_t i = 0; i < batch.count; ++i) {
+            if (&batch.entts[i] != reg.Deref(ptrs[2])) continue;
+            found = static_cast<const Pos*>(batch.ptrs[0])[i].a == 100;
+        }
+    }
+    bitecs_query_end(query);
+    CHECK(found);
+}
+
+TEST(Prefab, Instantiate)
+{
+    Registry reg;
+    reg.DefineComponent<Component1>(bitecs_freq2);
+    reg.DefineComponent<Component3>();
+    reg.DefineComponent<Boss>(bitecs_freq2);
+    reg.DefineSparseComponent<Marker<700>>();
+    auto prefab = reg.Entt(Component1{7, 8}, Component3{}, Boss{"bullet with a long enough name"}, Marker<700>{9});
+    std::vector<EntityPtr> out(1000);
+    reg.Instantiate(prefab, 1000, out.data());
+    CHECK(reg.Count<Component1>() == 1001);
+    auto all = reg.Count<Component1, Component3, Boss, Marker<700>>();
+    CHECK(all == 1001);
+    for (auto entt: out) {
+        CHECK(reg.GetComponent<Component1>(entt).a == 7 && reg.GetComponent<Component1>(entt).b == 8);
+        CHECK(reg.GetComponent<Boss>(entt).name == "bullet with a long enough name");
+        CHECK(reg.GetComponent<Marker<700>>(entt).a == 9);
+    }
+    reg.GetComponent<Boss>(out[3]).name = "changed";
+    CHECK(reg.GetComponent<Boss>(prefab).name == "bullet with a long enough name");
+    reg.Destroy(prefab);
+    EXPECT_THROW(reg.Instantiate(prefab, 10), std::runtime_error);
+}
+
 // TODO: test removal + add + removal + add